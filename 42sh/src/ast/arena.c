@@ -0,0 +1,90 @@
+#include "arena.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is aligned for the pointers and integers a node holds
+#define ARENA_ALIGN sizeof(void *)
+
+static size_t align(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+struct arena *arena_new(void)
+{
+    struct arena *arena = calloc(1, sizeof(struct arena));
+    if (!arena)
+        errx(1, "arena: out of memory");
+    return arena;
+}
+
+/*
+ * Blocks double in size so that a command of any length needs only a few of
+ * them; a request bigger than that gets a block of its own.
+ */
+static void add_block(struct arena *arena, size_t size)
+{
+    size_t block = arena->head ? 2 * arena->head->size : ARENA_BLOCK;
+    if (block < size)
+        block = size;
+    struct arena_block *new = malloc(sizeof(struct arena_block) + block);
+    if (!new)
+        errx(1, "arena: out of memory");
+    new->next = arena->head;
+    new->size = block;
+    new->used = 0;
+    arena->head = new;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = align(size);
+    if (!arena->head || arena->head->size - arena->head->used < size)
+        add_block(arena, size);
+    void *res = arena->head->data + arena->head->used;
+    arena->head->used += size;
+    arena->last = res;
+    return memset(res, 0, size);
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+                    size_t new_size)
+{
+    if (!ptr)
+        return arena_alloc(arena, new_size);
+    old_size = align(old_size);
+    new_size = align(new_size);
+    if (new_size <= old_size)
+        return ptr;
+    struct arena_block *head = arena->head;
+    if (ptr == arena->last && head->size - head->used >= new_size - old_size)
+    {
+        memset(head->data + head->used, 0, new_size - old_size);
+        head->used += new_size - old_size;
+        return ptr;
+    }
+    void *res = arena_alloc(arena, new_size);
+    return memcpy(res, ptr, old_size);
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+    char *res = arena_alloc(arena, len + 1);
+    return memcpy(res, s, len);
+}
+
+void arena_free(struct arena *arena)
+{
+    if (!arena)
+        return;
+    struct arena_block *block = arena->head;
+    while (block)
+    {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <unistd.h>
+
+/**
+ * \page Arena
+ *
+ * A bump allocator: memory is carved out of a few large blocks and is only
+ * given back all at once, when the arena is freed. The parser builds each
+ * command it reads in an arena of its own, so that parsing a command costs a
+ * handful of allocations and freeing it a single walk over the blocks.
+ */
+
+#define ARENA_BLOCK 4096
+
+struct arena_block
+{
+    struct arena_block *next; // Block filled before this one
+    size_t size; // Bytes available in data
+    size_t used; // Bytes of data already handed out
+    char data[]; // The memory handed out
+};
+
+struct arena
+{
+    struct arena_block *head; // Block being filled
+    void *last; // Most recent allocation, the only one that can grow in place
+};
+
+/**
+ * \brief Creates an empty arena. Its first block is allocated on first use.
+ */
+struct arena *arena_new(void);
+
+/**
+ * \brief Returns size bytes of zeroed memory that live as long as the arena.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * \brief Grows ptr, an allocation of old_size bytes from the arena, to
+ * new_size bytes. The most recent allocation grows in place; any other one is
+ * copied and its old bytes stay unused until the arena is freed.
+ */
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+                    size_t new_size);
+
+/**
+ * \brief Returns a NUL-terminated copy of the len bytes at s.
+ */
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+
+/**
+ * \brief Releases every block of the arena, and the arena itself.
+ */
+void arena_free(struct arena *arena);
+
+#endif /* !ARENA_H */
@@ -3,6 +3,9 @@
 #include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static struct ast **breadth_first(struct ast *ast, size_t *nb);
 
 struct ast *ast_new(enum ast_type type)
 {
@@ -13,6 +16,12 @@ struct ast *ast_new(enum ast_type type)
     return new;
 }
 
+int word_expands(const char *word)
+{
+    const char *bracket = strchr(word, '[');
+    return strpbrk(word, "$'\"\\`*?") || (bracket && strchr(bracket, ']'));
+}
+
 void data_free(struct ast *ast)
 {
     for (int i = 0; i < ast->nb_data; i++)
@@ -25,9 +34,172 @@ void ast_free(struct ast *ast)
 {
     if (!ast)
         return;
-    for (int i = 0; i < ast->nb_ast; i++)
-        ast_free(ast->ast_list[i]);
-    data_free(ast);
-    free(ast->ast_list);
-    free(ast);
+    if (ast->arena)
+    {
+        arena_free(ast->arena);
+        return;
+    }
+    size_t nb = 0;
+    struct ast **order = breadth_first(ast, &nb);
+    for (size_t i = 0; i < nb; i++)
+    {
+        data_free(order[i]);
+        free(order[i]->ast_list);
+        free(order[i]);
+    }
+    free(order);
+}
+
+/*
+ * Lists the nodes of the tree breadth first, without recursing, so that the
+ * children of order[i] come out next to each other.
+ */
+static struct ast **breadth_first(struct ast *ast, size_t *nb)
+{
+    size_t cap = 16;
+    struct ast **order = malloc(cap * sizeof(struct ast *));
+    if (!order)
+        errx(1, "ast: out of memory");
+    order[0] = ast;
+    *nb = 1;
+    for (size_t i = 0; i < *nb; i++)
+    {
+        struct ast *node = order[i];
+        if (*nb + node->nb_ast > cap)
+        {
+            while (*nb + node->nb_ast > cap)
+                cap *= 2;
+            order = realloc(order, cap * sizeof(struct ast *));
+            if (!order)
+                errx(1, "ast: out of memory");
+        }
+        for (int j = 0; j < node->nb_ast; j++)
+            order[(*nb)++] = node->ast_list[j];
+    }
+    return order;
+}
+
+static struct ast *flatten(struct ast *ast)
+{
+    size_t nb = 0;
+    struct ast **order = breadth_first(ast, &nb);
+    size_t nb_children = 0;
+    size_t nb_words = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < nb; i++)
+    {
+        nb_children += order[i]->nb_ast;
+        nb_words += order[i]->nb_data ? order[i]->nb_data + 1 : 0;
+        for (int j = 0; j < order[i]->nb_data; j++)
+            bytes += strlen(order[i]->data[j]) + 1;
+    }
+    struct arena *arena = arena_new();
+    struct ast *nodes = arena_alloc(arena,
+                                    nb * sizeof(struct ast)
+                                        + nb_children * sizeof(struct ast *)
+                                        + nb_words * sizeof(char *) + bytes);
+    struct ast **children = (struct ast **)(nodes + nb);
+    char **words = (char **)(children + nb_children);
+    char *text = (char *)(words + nb_words);
+    size_t next = 1;
+    for (size_t i = 0; i < nb; i++)
+    {
+        struct ast *node = order[i];
+        nodes[i].type = node->type;
+        nodes[i].nb_data = node->nb_data;
+        nodes[i].nb_ast = node->nb_ast;
+        nodes[i].expand = node->expand;
+        if (node->nb_data)
+            nodes[i].data = words;
+        for (int j = 0; j < node->nb_data; j++)
+        {
+            size_t len = strlen(node->data[j]) + 1;
+            *words++ = memcpy(text, node->data[j], len);
+            text += len;
+        }
+        if (node->nb_data)
+            *words++ = NULL;
+        if (node->nb_ast)
+            nodes[i].ast_list = children;
+        for (int j = 0; j < node->nb_ast; j++)
+            *children++ = nodes + next++;
+    }
+    nodes->arena = arena;
+    free(order);
+    return nodes;
+}
+
+struct ast *ast_flatten(struct ast *ast)
+{
+    if (!ast)
+        return NULL;
+    struct ast *res = flatten(ast);
+    ast_free(ast);
+    return res;
+}
+
+struct ast *ast_copy(struct ast *ast)
+{
+    return ast ? flatten(ast) : NULL;
+}
+
+static const char *type_name(enum ast_type type)
+{
+    static const char *names[] = {
+        [AST_IF] = "if",
+        [AST_COMMAND] = "command",
+        [AST_LIST] = "list",
+        [AST_REDIR] = "redirection",
+        [AST_PIPE] = "pipe",
+        [AST_AND] = "&&",
+        [AST_OR] = "||",
+        [AST_WHILE] = "while",
+        [AST_UNTIL] = "until",
+        [AST_FOR] = "for",
+        [AST_NEG] = "!",
+        [AST_ASSIGNMENT_WORD] = "assignment",
+        [AST_COMMAND_BLOCK] = "{ }",
+        [AST_SUBSHELL] = "( )",
+        [AST_FUNCTION] = "function",
+    };
+    return names[type];
+}
+
+static void dot_word(FILE *file, const char *word)
+{
+    for (; *word; word++)
+    {
+        if (*word == '"' || *word == '\\')
+            fputc('\\', file);
+        fputc(*word, file);
+    }
+}
+
+void generate_dot(struct ast *node)
+{
+    FILE *file = fopen("ast.dot", "w");
+    if (!file)
+        errx(1, "Could not open ast.dot");
+    fprintf(file, "digraph ast {\n");
+    if (node)
+    {
+        size_t nb = 0;
+        struct ast **order = breadth_first(node, &nb);
+        size_t next = 1;
+        for (size_t i = 0; i < nb; i++)
+        {
+            fprintf(file, "    n%zu [label=\"%s", i, type_name(order[i]->type));
+            for (int j = 0; j < order[i]->nb_data; j++)
+            {
+                fputc(' ', file);
+                dot_word(file, order[i]->data[j]);
+            }
+            fprintf(file, "\"];\n");
+            for (int j = 0; j < order[i]->nb_ast; j++)
+                fprintf(file, "    n%zu -> n%zu;\n", i, next++);
+        }
+        free(order);
+    }
+    fprintf(file, "}\n");
+    fclose(file);
 }
@@ -3,6 +3,8 @@
 
 #include <unistd.h>
 
+#include "arena.h"
+
 enum ast_type
 {
     AST_IF,
@@ -35,13 +37,58 @@ struct ast
     int nb_data; /// number of words in the data
     struct ast **ast_list; /// general tree
     int nb_ast; /// number of children
+    struct arena *arena; /// owns the whole tree, only set on a parsed root
+    int expand; /// words of data to expand, 0 when data is a ready argv
 };
 
+/**
+ ** \brief Whether the word changes when expanded: it holds a parameter, a
+ ** command substitution, quotes, a backslash or a pattern. The parser counts
+ ** these words in expand, the others are used as they are written.
+ */
+int word_expands(const char *word);
+
 /**
  ** \brief Allocate a new ast with the given type
  */
 struct ast *ast_new(enum ast_type type);
+
+/**
+ ** \brief Writes the tree to ast.dot, for tests/ast_display.sh to draw.
+ */
 void generate_dot(struct ast *node);
+
+/**
+ ** \brief Moves a tree into a single block and frees the original. Nodes are
+ ** laid out breadth first, so the children of a node are a contiguous range
+ ** of the node array, followed by the child and word tables and the text of
+ ** every word. The words of a node stay followed by a NULL. The new root
+ ** owns the block and is freed with ast_free.
+ */
+struct ast *ast_flatten(struct ast *ast);
+
+/**
+ ** \brief Returns a copy of the tree laid out as ast_flatten does, which owns
+ ** its block. ast may be any subtree and is left as it is.
+ */
+struct ast *ast_copy(struct ast *ast);
+
+#define OPTIMIZE_DEBUG_ENV "SH42_DEBUG_OPTIMIZE"
+
+/**
+ ** \brief Rewrites a parsed tree into one that does the same with fewer
+ ** nodes: nested lists and && or || chains are merged, lists of one node are
+ ** dropped, and an if, while or until whose condition is true or false loses
+ ** the branches that cannot run. New nodes come from the arena of the root,
+ ** and the root returned owns it. With debug, the number of nodes before and
+ ** after is written to stderr.
+ */
+struct ast *ast_optimize(struct ast *ast, int debug);
+
+/**
+ ** \brief Frees a tree. A tree built by the parser lives in an arena and is
+ ** released at once from its root, which is the only node to pass here.
+ */
 void ast_free(struct ast *ast);
 void data_free(struct ast *ast);
 
@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "42shast"
+
+struct cache_header
+{
+    char magic[8]; // CACHE_MAGIC
+    uint32_t version; // CACHE_VERSION
+    uint32_t node_size; // sizeof(struct ast) of the build that wrote it
+    uint64_t hash; // Hash of the script
+    uint64_t len; // Length of the script
+    uint64_t nb_commands; // Number of blocks that follow
+};
+
+// Each command is a block header followed by size bytes of flattened tree
+struct cache_block
+{
+    uint64_t size; // Bytes of the tree
+    uint64_t nb_nodes; // Nodes at the start of the tree
+    uint64_t check; // Hash of the tree, to catch a damaged entry
+};
+
+/*
+ * A 64-bit multiplicative hash that reads the script a word at a time, as
+ * scripts worth caching are large and it runs on every lookup.
+ */
+static uint64_t hash(const char *script, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ len;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, script + i, sizeof(uint64_t));
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++)
+        h = (h ^ (unsigned char)script[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+struct cache *cache_new(const char *script, size_t len)
+{
+    const char *dir = getenv(CACHE_DIR_ENV);
+    if (!dir || !*dir)
+        return NULL;
+    struct cache *cache = calloc(1, sizeof(struct cache));
+    if (!cache)
+        return NULL;
+    mkdir(dir, 0700);
+    cache->hash = hash(script, len);
+    cache->len = len;
+    size_t size = strlen(dir) + 64;
+    cache->path = malloc(size);
+    cache->tmp = malloc(size);
+    if (!cache->path || !cache->tmp)
+    {
+        cache_free(cache);
+        return NULL;
+    }
+    snprintf(cache->path, size, "%s/%016llx-%llx.ast", dir,
+             (unsigned long long)cache->hash, (unsigned long long)len);
+    snprintf(cache->tmp, size, "%s/.%016llx.%ld", dir,
+             (unsigned long long)cache->hash, (long)getpid());
+    return cache;
+}
+
+/*
+ * The layout is the one of ast_flatten: nb nodes, the child table, the word
+ * table, then the text of the words. Counts the entries of both tables, the
+ * words of each node being followed by a NULL.
+ */
+static void count_tables(struct ast *nodes, size_t nb, size_t *children,
+                         size_t *words)
+{
+    *children = 0;
+    *words = 0;
+    for (size_t i = 0; i < nb; i++)
+    {
+        *children += nodes[i].nb_ast;
+        *words += nodes[i].nb_data ? nodes[i].nb_data + 1 : 0;
+    }
+}
+
+static uint64_t offset(const void *ptr, const void *base)
+{
+    return ptr ? (uint64_t)((const char *)ptr - (const char *)base) : 0;
+}
+
+/*
+ * Turns the pointers of the tree copied at block into offsets from its start,
+ * 0 standing for NULL as no pointer can point at the root itself.
+ */
+static void unrelocate(char *block, struct ast *ast, size_t nb)
+{
+    struct ast *nodes = (struct ast *)block;
+    size_t nb_children = 0;
+    size_t nb_words = 0;
+    count_tables(nodes, nb, &nb_children, &nb_words);
+    uint64_t *children = (uint64_t *)(nodes + nb);
+    struct ast **child = (struct ast **)(ast + nb);
+    for (size_t i = 0; i < nb_children; i++)
+        children[i] = offset(child[i], ast);
+    uint64_t *words = children + nb_children;
+    char **word = (char **)(child + nb_children);
+    for (size_t i = 0; i < nb_words; i++)
+        words[i] = offset(word[i], ast);
+    for (size_t i = 0; i < nb; i++)
+    {
+        nodes[i].data = (char **)(uintptr_t)offset(ast[i].data, ast);
+        nodes[i].ast_list = (struct ast **)(uintptr_t)offset(ast[i].ast_list,
+                                                             ast);
+        nodes[i].arena = NULL;
+    }
+}
+
+void cache_add(struct cache *cache, struct ast *ast)
+{
+    if (!cache->file)
+    {
+        cache->file = fopen(cache->tmp, "w");
+        if (!cache->file)
+            return;
+        struct cache_header header = { CACHE_MAGIC, CACHE_VERSION,
+                                       sizeof(struct ast), cache->hash,
+                                       cache->len, 0 };
+        fwrite(&header, sizeof(header), 1, cache->file);
+    }
+    size_t nb = 1;
+    for (size_t i = 0; i < nb; i++)
+        nb += ast[i].nb_ast;
+    size_t nb_children = 0;
+    size_t nb_words = 0;
+    count_tables(ast, nb, &nb_children, &nb_words);
+    char *end = (char *)((struct ast **)(ast + nb) + nb_children + nb_words);
+    if (nb_words)
+    {
+        char *last = ((char **)(ast + nb) + nb_children)[nb_words - 2];
+        end = last + strlen(last) + 1;
+    }
+    struct cache_block block = { end - (char *)ast, nb, 0 };
+    char *copy = malloc(block.size);
+    if (!copy)
+        errx(1, "cache: out of memory");
+    memcpy(copy, ast, block.size);
+    unrelocate(copy, ast, nb);
+    block.check = hash(copy, block.size);
+    fwrite(&block, sizeof(block), 1, cache->file);
+    fwrite(copy, block.size, 1, cache->file);
+    free(copy);
+    cache->nb_commands++;
+}
+
+void cache_commit(struct cache *cache)
+{
+    if (!cache->file)
+        return;
+    struct cache_header header = { CACHE_MAGIC, CACHE_VERSION,
+                                   sizeof(struct ast), cache->hash,
+                                   cache->len, cache->nb_commands };
+    int ok = fseek(cache->file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, cache->file) == 1;
+    ok = fclose(cache->file) == 0 && ok;
+    cache->file = NULL;
+    if (!ok || rename(cache->tmp, cache->path) == -1)
+        unlink(cache->tmp);
+}
+
+void cache_free(struct cache *cache)
+{
+    if (!cache)
+        return;
+    if (cache->file)
+    {
+        fclose(cache->file);
+        unlink(cache->tmp);
+    }
+    free(cache->path);
+    free(cache->tmp);
+    free(cache);
+}
+
+/*
+ * Checks that the table of count entries at off lies in [start, end) of the
+ * block, or that there is none.
+ */
+static int in_table(uint64_t off, int count, size_t start, size_t end)
+{
+    if (!count)
+        return off == 0;
+    return off >= start && off % sizeof(void *) == 0
+        && off + count * sizeof(void *) <= end;
+}
+
+/*
+ * Turns the offsets of the block back into pointers, checking that each one
+ * stays in its part of the block and that children come after their parent,
+ * so that a corrupted entry cannot make a cycle. Returns 0 if the block is
+ * not a valid tree.
+ */
+static int relocate(char *block, size_t size, size_t nb)
+{
+    struct ast *nodes = (struct ast *)block;
+    size_t nb_children = 0;
+    size_t nb_words = 0;
+    for (size_t i = 0; i < nb; i++)
+    {
+        if (nodes[i].nb_ast < 0 || nodes[i].nb_data < 0
+            || nodes[i].nb_data == INT_MAX || nodes[i].type > AST_FUNCTION)
+            return 0;
+        nb_children += nodes[i].nb_ast;
+        nb_words += nodes[i].nb_data ? nodes[i].nb_data + 1 : 0;
+    }
+    size_t words_start = nb * sizeof(struct ast) + nb_children * sizeof(void *);
+    size_t tables = words_start + nb_words * sizeof(void *);
+    if (nb_children + 1 != nb || tables > size
+        || (nb_words && block[size - 1]))
+        return 0;
+    uint64_t *words = (uint64_t *)(block + words_start);
+    for (size_t i = 0; i < nb_words; i++)
+    {
+        if (words[i] && (words[i] < tables || words[i] >= size))
+            return 0;
+        ((char **)words)[i] = words[i] ? block + words[i] : NULL;
+    }
+    for (size_t i = 0; i < nb; i++)
+    {
+        uint64_t data = (uintptr_t)nodes[i].data;
+        uint64_t list = (uintptr_t)nodes[i].ast_list;
+        int nb_data = nodes[i].nb_data ? nodes[i].nb_data + 1 : 0;
+        if (!in_table(data, nb_data, words_start, tables)
+            || !in_table(list, nodes[i].nb_ast, nb * sizeof(struct ast),
+                         words_start))
+            return 0;
+        nodes[i].data = data ? (char **)(block + data) : NULL;
+        for (int j = 0; j < nb_data; j++)
+            if ((nodes[i].data[j] == NULL) != (j == nodes[i].nb_data))
+                return 0;
+        nodes[i].ast_list = list ? (struct ast **)(block + list) : NULL;
+        uint64_t *children = (uint64_t *)nodes[i].ast_list;
+        for (int j = 0; j < nodes[i].nb_ast; j++)
+        {
+            if (children[j] % sizeof(struct ast)
+                || children[j] / sizeof(struct ast) <= i
+                || children[j] >= nb * sizeof(struct ast))
+                return 0;
+            nodes[i].ast_list[j] = (struct ast *)(block + children[j]);
+        }
+    }
+    return 1;
+}
+
+static struct ast *load_block(const char **pos, const char *end)
+{
+    struct cache_block block;
+    if ((size_t)(end - *pos) < sizeof(block))
+        return NULL;
+    memcpy(&block, *pos, sizeof(block));
+    *pos += sizeof(block);
+    if (block.nb_nodes == 0 || block.size > (uint64_t)(end - *pos)
+        || block.nb_nodes > block.size / sizeof(struct ast)
+        || hash(*pos, block.size) != block.check)
+        return NULL;
+    struct arena *arena = arena_new();
+    char *copy = arena_alloc(arena, block.size);
+    memcpy(copy, *pos, block.size);
+    *pos += block.size;
+    if (!relocate(copy, block.size, block.nb_nodes))
+    {
+        arena_free(arena);
+        return NULL;
+    }
+    struct ast *ast = (struct ast *)copy;
+    ast->arena = arena;
+    return ast;
+}
+
+static struct ast **load(const char *map, size_t size, struct cache *cache,
+                         size_t *nb)
+{
+    struct cache_header header;
+    if (size < sizeof(header))
+        return NULL;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic))
+        || header.version != CACHE_VERSION
+        || header.node_size != sizeof(struct ast) || header.hash != cache->hash
+        || header.len != cache->len || header.nb_commands == 0
+        || header.nb_commands > size / sizeof(struct cache_block))
+        return NULL;
+    struct ast **res = calloc(header.nb_commands, sizeof(struct ast *));
+    if (!res)
+        return NULL;
+    const char *pos = map + sizeof(header);
+    for (*nb = 0; *nb < header.nb_commands; (*nb)++)
+    {
+        res[*nb] = load_block(&pos, map + size);
+        if (res[*nb])
+            continue;
+        while (*nb > 0)
+            ast_free(res[--(*nb)]);
+        free(res);
+        return NULL;
+    }
+    return res;
+}
+
+struct ast **cache_load(struct cache *cache, size_t *nb)
+{
+    if (!cache)
+        return NULL;
+    int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    struct ast **res = load(map, st.st_size, cache, nb);
+    munmap(map, st.st_size);
+    return res;
+}
@@ -0,0 +1,64 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+
+/**
+ * \page Cache
+ *
+ * An on-disk cache of parsed scripts, enabled by setting SH42_CACHE_DIR to a
+ * directory. A script is looked up by a hash of its content, so an edited
+ * script simply misses. The entry holds the flattened tree of every command
+ * with its pointers stored as offsets, and is loaded by mapping the file and
+ * relocating each tree into an arena, without lexing or parsing anything.
+ *
+ * Entries depend on the layout of struct ast: CACHE_VERSION must change with
+ * it or with the grammar, and the size of a node is checked on load.
+ */
+
+#define CACHE_VERSION 5
+#define CACHE_DIR_ENV "SH42_CACHE_DIR"
+
+struct cache
+{
+    uint64_t hash; // Hash of the script
+    uint64_t len; // Length of the script
+    char *path; // Where the entry of the script is stored
+    char *tmp; // Where the entry is written before being committed
+    FILE *file; // Entry being written, NULL until the first command
+    uint64_t nb_commands; // Commands written so far
+};
+
+/**
+ * \brief Prepares the lookup of the len bytes of script, or returns NULL when
+ * SH42_CACHE_DIR is not set.
+ */
+struct cache *cache_new(const char *script, size_t len);
+
+/**
+ * \brief Returns the commands stored for the script, in order, and their
+ * number in nb, or NULL if there is no valid entry. Each tree is a flattened
+ * root that owns its arena, and the array is the caller's to free.
+ */
+struct ast **cache_load(struct cache *cache, size_t *nb);
+
+/**
+ * \brief Appends the flattened tree of the next command to the entry being
+ * written.
+ */
+void cache_add(struct cache *cache, struct ast *ast);
+
+/**
+ * \brief Publishes the entry once every command of the script was added.
+ */
+void cache_commit(struct cache *cache);
+
+/**
+ * \brief Frees the cache, dropping an entry that was not committed.
+ */
+void cache_free(struct cache *cache);
+
+#endif /* !CACHE_H */
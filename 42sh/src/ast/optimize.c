@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ast.h"
+
+/*
+ * The rewrites must not change what a script does, including when $? is
+ * updated: the evaluator stores the status after running a command, a list,
+ * an if, a pipe, &&, ||, a redirection or a while, but not after the other
+ * nodes. A node can only stand in for another one when both leave $? alike.
+ */
+static int sets_status(const struct ast *ast)
+{
+    switch (ast->type)
+    {
+    case AST_COMMAND:
+    case AST_LIST:
+    case AST_IF:
+    case AST_PIPE:
+    case AST_AND:
+    case AST_OR:
+    case AST_REDIR:
+    case AST_WHILE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static struct ast *new_node(struct arena *arena, enum ast_type type, int nb)
+{
+    struct ast *ast = arena_alloc(arena, sizeof(struct ast));
+    ast->type = type;
+    ast->nb_ast = nb;
+    if (nb)
+        ast->ast_list = arena_alloc(arena, nb * sizeof(struct ast *));
+    return ast;
+}
+
+// A list running first then second, for a node folded into its condition
+static struct ast *sequence(struct arena *arena, struct ast *first,
+                            struct ast *second)
+{
+    struct ast *ast = new_node(arena, AST_LIST, 2);
+    ast->ast_list[0] = first;
+    ast->ast_list[1] = second;
+    return ast;
+}
+
+// A true command, for the status of an if or a while that runs nothing
+static struct ast *true_command(struct arena *arena)
+{
+    struct ast *ast = new_node(arena, AST_COMMAND, 0);
+    ast->data = arena_alloc(arena, 2 * sizeof(char *));
+    ast->data[0] = arena_strndup(arena, "true", 4);
+    ast->nb_data = 1;
+    return ast;
+}
+
+/*
+ * Returns the status a condition always has, or -1 when it depends on what
+ * runs. Only true, false and ! of them are known: they cannot fail or leave
+ * a break pending, so they can be run without looking at their status.
+ */
+static int known_status(const struct ast *ast)
+{
+    int status = -1;
+    switch (ast->type)
+    {
+    case AST_COMMAND:
+        if (ast->nb_data && !strcmp(ast->data[0], "true"))
+            status = 0;
+        else if (ast->nb_data && !strcmp(ast->data[0], "false"))
+            status = 1;
+        break;
+    case AST_NEG:
+        status = known_status(ast->ast_list[0]);
+        if (status != -1)
+            status = !status;
+        break;
+    case AST_LIST:
+    case AST_COMMAND_BLOCK:
+        if (ast->nb_ast == 1)
+            status = known_status(ast->ast_list[0]);
+        break;
+    default:
+        break;
+    }
+    return status;
+}
+
+/*
+ * Moves the children of nested nodes of the same type into their parent:
+ * lists stop at a pending break either way, and && and || give the same
+ * status. A nested node sets $? after its last child, so it is only merged
+ * when that child already does.
+ */
+static void merge_nested(struct ast *ast, struct arena *arena)
+{
+    int nb = 0;
+    for (int i = 0; i < ast->nb_ast; i++)
+    {
+        struct ast *child = ast->ast_list[i];
+        if (child->type == ast->type && child->nb_ast
+            && sets_status(child->ast_list[child->nb_ast - 1]))
+            nb += child->nb_ast;
+        else
+            nb++;
+    }
+    if (nb == ast->nb_ast)
+        return;
+    struct ast **list = arena_alloc(arena, nb * sizeof(struct ast *));
+    int j = 0;
+    for (int i = 0; i < ast->nb_ast; i++)
+    {
+        struct ast *child = ast->ast_list[i];
+        if (child->type == ast->type && child->nb_ast
+            && sets_status(child->ast_list[child->nb_ast - 1]))
+            for (int k = 0; k < child->nb_ast; k++)
+                list[j++] = child->ast_list[k];
+        else
+            list[j++] = child;
+    }
+    ast->ast_list = list;
+    ast->nb_ast = nb;
+}
+
+/*
+ * An if whose condition is known becomes the condition followed by the
+ * branch that runs, and a loop whose body never runs becomes its condition.
+ * A while sets $? to 0 when it ends, and so does an if without else whose
+ * condition fails, hence the true command after the condition.
+ */
+static struct ast *fold(struct ast *ast, struct arena *arena)
+{
+    int status = ast->nb_ast ? known_status(ast->ast_list[0]) : -1;
+    if (status == -1)
+        return ast;
+    struct ast *cond = ast->ast_list[0];
+    if (ast->type == AST_IF && !status)
+        return sequence(arena, cond, ast->ast_list[1]);
+    if (ast->type == AST_IF && ast->nb_ast == 3)
+        return sequence(arena, cond, ast->ast_list[2]);
+    if (ast->type == AST_IF || (ast->type == AST_WHILE && status))
+        return sequence(arena, cond, true_command(arena));
+    if (ast->type == AST_UNTIL && !status)
+        return cond;
+    return ast;
+}
+
+static struct ast *optimize(struct ast *ast, struct arena *arena)
+{
+    for (int i = 0; i < ast->nb_ast; i++)
+        ast->ast_list[i] = optimize(ast->ast_list[i], arena);
+    if (ast->type == AST_IF || ast->type == AST_WHILE
+        || ast->type == AST_UNTIL)
+        ast = fold(ast, arena);
+    if (ast->type == AST_LIST || ast->type == AST_AND || ast->type == AST_OR)
+        merge_nested(ast, arena);
+    if (ast->type == AST_LIST && ast->nb_ast == 1
+        && sets_status(ast->ast_list[0]))
+        return ast->ast_list[0];
+    return ast;
+}
+
+static size_t count_nodes(const struct ast *ast)
+{
+    size_t nb = 1;
+    for (int i = 0; i < ast->nb_ast; i++)
+        nb += count_nodes(ast->ast_list[i]);
+    return nb;
+}
+
+struct ast *ast_optimize(struct ast *ast, int debug)
+{
+    if (!ast || !ast->arena)
+        return ast;
+    struct arena *arena = ast->arena;
+    size_t before = debug ? count_nodes(ast) : 0;
+    ast->arena = NULL;
+    ast = optimize(ast, arena);
+    ast->arena = arena;
+    if (debug)
+        fprintf(stderr, "optimize: %zu -> %zu nodes\n", before,
+                count_nodes(ast));
+    return ast;
+}
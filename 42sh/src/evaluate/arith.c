@@ -0,0 +1,333 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "arith.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evaluate.h"
+
+struct arith
+{
+    const char *expr; // The whole expression, for errors
+    const char *p; // Next byte to read
+    struct dico *var;
+    int skip; // Whether operands are only parsed, as after a false &&
+    int depth; // Operands being parsed inside one another
+};
+
+// The binary operators, longest first so that << is not read as <
+static const struct binary
+{
+    const char *op;
+    int prec; // Higher binds more tightly
+} binaries[] = {
+    { "||", 1 }, { "&&", 2 }, { "==", 6 }, { "!=", 6 }, { "<=", 7 },
+    { ">=", 7 }, { "<<", 8 }, { ">>", 8 }, { "|", 3 },  { "^", 4 },
+    { "&", 5 },  { "<", 7 },  { ">", 7 },  { "+", 9 },  { "-", 9 },
+    { "*", 10 }, { "/", 10 }, { "%", 10 },
+};
+
+// What precedes the = of each assignment operator
+static const char *const assignments[] = {
+    "<<", ">>", "*", "/", "%", "+", "-", "&", "^", "|", "",
+};
+
+static void error(const struct arith *a, const char *msg)
+{
+    errx(1, "%s: %s", a->expr, msg);
+}
+
+/*
+ * Goes one operand deeper. Past ARITH_MAX_DEPTH nested operands the
+ * expression is rejected, instead of letting the C stack overflow.
+ */
+static void deeper(struct arith *a)
+{
+    if (++a->depth > ARITH_MAX_DEPTH)
+        error(a, "expression nested too deeply");
+}
+
+static void blank(struct arith *a)
+{
+    while (isspace((unsigned char)*a->p))
+        a->p++;
+}
+
+static int is_name(char c, int first)
+{
+    return isalpha((unsigned char)c) || c == '_'
+        || (!first && isdigit((unsigned char)c));
+}
+
+static size_t name_length(const char *s)
+{
+    size_t len = 0;
+    if (is_name(*s, 1))
+        while (is_name(s[len], 0))
+            len++;
+    return len;
+}
+
+/*
+ * Reads the integer constant at s, in octal after a 0 and in hexadecimal
+ * after 0x, and stores what follows it in *end. Returns 0 when it is not a
+ * number, such as 08 or 1a.
+ */
+static int number(const char *s, const char **end, int64_t *res)
+{
+    int base = 10;
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        base = 16;
+        s += 2;
+    }
+    else if (s[0] == '0')
+        base = 8;
+    uint64_t n = 0;
+    for (; isalnum((unsigned char)*s); s++)
+    {
+        int digit = isdigit((unsigned char)*s)
+            ? *s - '0'
+            : tolower((unsigned char)*s) - 'a' + 10;
+        if (digit >= base)
+            return 0;
+        n = n * base + digit;
+    }
+    *end = s;
+    *res = (int64_t)n;
+    return 1;
+}
+
+// The value of a variable, an integer with an optional sign; 0 if empty
+static int64_t value_of(struct arith *a, const char *name, size_t len)
+{
+    if (a->skip)
+        return 0;
+    char *key = strndup(name, len);
+    struct key_value *var = find_var(a->var, key);
+    free(key);
+    const char *s = var && var->value ? var->value : "";
+    while (isspace((unsigned char)*s))
+        s++;
+    if (!*s)
+        return 0;
+    int negative = *s == '-';
+    s += negative || *s == '+';
+    int64_t n = 0;
+    const char *end = s;
+    if (!isdigit((unsigned char)*s) || !number(s, &end, &n))
+        error(a, "bad number");
+    while (isspace((unsigned char)*end))
+        end++;
+    if (*end)
+        error(a, "bad number");
+    return negative ? (int64_t)(0 - (uint64_t)n) : n;
+}
+
+static void store(struct arith *a, const char *name, size_t len, int64_t n)
+{
+    char *key = strndup(name, len);
+    char buff[32];
+    sprintf(buff, "%" PRId64, n);
+    set_var(a->var, key, buff);
+    free(key);
+}
+
+/*
+ * Applies a binary operator. Overflows wrap around instead of being
+ * undefined, and shift counts are taken modulo 64.
+ */
+static int64_t apply(struct arith *a, const char *op, int64_t l, int64_t r)
+{
+    uint64_t ul = l;
+    uint64_t ur = r;
+    switch (op[0])
+    {
+    case '|':
+        return op[1] ? l || r : l | r;
+    case '&':
+        return op[1] ? l && r : l & r;
+    case '^':
+        return l ^ r;
+    case '=':
+        return l == r;
+    case '!':
+        return l != r;
+    case '<':
+        if (op[1] == '<')
+            return (int64_t)(ul << (r & 63));
+        return op[1] ? l <= r : l < r;
+    case '>':
+        if (op[1] == '>')
+            return l >> (r & 63);
+        return op[1] ? l >= r : l > r;
+    case '+':
+        return (int64_t)(ul + ur);
+    case '-':
+        return (int64_t)(ul - ur);
+    case '*':
+        return (int64_t)(ul * ur);
+    default:
+        if (a->skip)
+            return 0;
+        if (!r)
+            error(a, "division by zero");
+        if (r == -1)
+            return op[0] == '/' ? (int64_t)(0 - ul) : 0;
+        return op[0] == '/' ? l / r : l % r;
+    }
+}
+
+static int64_t comma(struct arith *a);
+
+static int64_t unary(struct arith *a)
+{
+    blank(a);
+    char c = *a->p;
+    if (c && strchr("+-~!", c))
+    {
+        a->p++;
+        deeper(a);
+        int64_t n = unary(a);
+        a->depth--;
+        if (c == '-')
+            return (int64_t)(0 - (uint64_t)n);
+        return c == '+' ? n : c == '~' ? ~n : !n;
+    }
+    if (c == '(')
+    {
+        a->p++;
+        deeper(a);
+        int64_t n = comma(a);
+        a->depth--;
+        blank(a);
+        if (*a->p != ')')
+            error(a, "expecting ')'");
+        a->p++;
+        return n;
+    }
+    int64_t n = 0;
+    if (isdigit((unsigned char)c))
+    {
+        if (!number(a->p, &a->p, &n))
+            error(a, "bad number");
+        return n;
+    }
+    size_t len = name_length(a->p);
+    if (!len)
+        error(a, "syntax error");
+    n = value_of(a, a->p, len);
+    a->p += len;
+    return n;
+}
+
+static const struct binary *binary_at(struct arith *a)
+{
+    blank(a);
+    for (size_t i = 0; i < sizeof(binaries) / sizeof(*binaries); i++)
+        if (!strncmp(a->p, binaries[i].op, strlen(binaries[i].op)))
+            return binaries + i;
+    return NULL;
+}
+
+/*
+ * Reads operands joined by operators that bind at least as tightly as min.
+ * The right operand of one takes the operators that bind more tightly. The
+ * right operand of || and && is only parsed when the left one decides.
+ */
+static int64_t binary(struct arith *a, int min)
+{
+    int64_t l = unary(a);
+    const struct binary *op;
+    while ((op = binary_at(a)) && op->prec >= min)
+    {
+        a->p += strlen(op->op);
+        int lazy = (op->prec == 1 && l) || (op->prec == 2 && !l);
+        a->skip += lazy;
+        int64_t r = binary(a, op->prec + 1);
+        a->skip -= lazy;
+        l = apply(a, op->op, l, r);
+    }
+    return l;
+}
+
+static int64_t assignment(struct arith *a);
+
+static int64_t ternary(struct arith *a)
+{
+    int64_t cond = binary(a, 1);
+    blank(a);
+    if (*a->p != '?')
+        return cond;
+    a->p++;
+    a->skip += !cond;
+    deeper(a);
+    int64_t yes = comma(a);
+    a->skip -= !cond;
+    blank(a);
+    if (*a->p != ':')
+        error(a, "expecting ':'");
+    a->p++;
+    a->skip += !!cond;
+    int64_t no = assignment(a);
+    a->skip -= !!cond;
+    a->depth--;
+    return cond ? yes : no;
+}
+
+// A name followed by an assignment operator, or a conditional expression
+static int64_t assignment(struct arith *a)
+{
+    blank(a);
+    const char *name = a->p;
+    size_t len = name_length(name);
+    const char *q = name + len;
+    while (len && isspace((unsigned char)*q))
+        q++;
+    for (size_t i = 0; len && i < sizeof(assignments) / sizeof(char *); i++)
+    {
+        size_t n = strlen(assignments[i]);
+        if (strncmp(q, assignments[i], n) || q[n] != '='
+            || (!n && q[1] == '='))
+            continue;
+        a->p = q + n + 1;
+        deeper(a);
+        int64_t r = assignment(a);
+        a->depth--;
+        if (n)
+            r = apply(a, assignments[i], value_of(a, name, len), r);
+        if (!a->skip)
+            store(a, name, len, r);
+        return r;
+    }
+    return ternary(a);
+}
+
+static int64_t comma(struct arith *a)
+{
+    int64_t n = assignment(a);
+    for (blank(a); *a->p == ','; blank(a))
+    {
+        a->p++;
+        n = assignment(a);
+    }
+    return n;
+}
+
+int64_t arith(const char *expr, struct dico *var)
+{
+    struct arith a = { expr, expr, var, 0, 0 };
+    blank(&a);
+    if (!*a.p)
+        return 0;
+    int64_t n = comma(&a);
+    blank(&a);
+    if (*a.p)
+        error(&a, "syntax error");
+    return n;
+}
@@ -0,0 +1,25 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+
+/*
+ * How deep parentheses, unary operators and assignments may nest in an
+ * expression. Each one recurses on the C stack, so this bounds the stack
+ * they use.
+ */
+#ifndef ARITH_MAX_DEPTH
+#define ARITH_MAX_DEPTH 1000
+#endif
+
+struct dico;
+
+/**
+ * \brief Evaluates the arithmetic expression of $((expr)), whose parameters
+ * were already expanded. It has the operators of C but ++ and --, and names
+ * variables without $, which are read and assigned in var. Exits on a syntax
+ * error, a division by zero or an expression nested too deeply.
+ */
+int64_t arith(const char *expr, struct dico *var);
+
+#endif /* !ARITH_H */
@@ -3,7 +3,9 @@
 #include "evaluate.h"
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,274 +14,226 @@
 #include <unistd.h>
 
 #include "../ast/ast.h"
+#include "../ast/cache.h"
 #include "../lexer/lexer.h"
 #include "../parser/parser.h"
+#include "expand.h"
+#include "pathname.h"
+#include "vm.h"
 
-int global_fd = 1;
+// Bytes read from a command substitution at once, at least
+#define SUBSTITUTE_READ 4096
 
-static int read_file(FILE *file)
-{
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    char *ptr = calloc(size + 1, sizeof(char));
-    fseek(file, 0, SEEK_SET);
-    size_t reaad = fread(ptr, sizeof(char), size, file);
-    if (!reaad)
-    {
-        free(ptr);
-        ptr = "";
-    }
-    struct lexer *lexer = lexer_new(ptr);
-    struct ast *ast = NULL;
-    lexer->pos = 0;
-    enum parser_status status = parse(&ast, lexer);
-    struct token token = lexer_peek(lexer);
-    while (status == PARSER_OK && token.type != TOKEN_EOF)
-    {
-        while (token.type == TOKEN_BACKSLASH)
-        {
-            lexer_pop(lexer);
-            token = lexer_peek(lexer);
-        }
-        token_free(token);
-        struct ast *new = NULL;
-        status = parse(&new, lexer);
-        if (new)
-            ast = add_child(ast, new);
-        token = lexer_peek(lexer);
-    }
-    int res = 0;
-    if (ast && status == PARSER_OK)
-    {
-        res = evaluate(ast);
-        ast_free(ast);
-    }
-    else
-        res = reaad ? 2 : 0;
-    lexer_free(lexer);
-    if (reaad)
-        free(ptr);
-    return res;
-}
+int global_fd = 1;
 
-static int open_file(char *path, int mode)
-{
-    FILE *file = NULL;
-    if (mode)
-        file = fmemopen(path, strlen(path), "r");
-    else
-        file = fopen(path, "r");
-    if (!file)
-        errx(1, "Could not open file");
-    int res = read_file(file);
-    fclose(file);
-    return res;
-}
+static int run_lexer(struct lexer *lexer, struct dico *var);
 
-static int eval_dot(struct ast *ast)
+static int eval_dot(struct ast *ast, struct dico *var)
 {
     char **argv = ast->data;
-    int res = 0;
-    res = open_file(argv[1], 0);
+    struct lexer *lexer = lexer_new_file(argv[1]);
+    if (!lexer)
+        errx(1, "Could not open file");
+    int res = run_lexer(lexer, var);
+    lexer_free(lexer);
     return res;
 }
 
 static struct dico *new_dico(void)
 {
     struct dico *d = malloc(sizeof(struct dico));
-    d->entries = malloc(100);
-    d->size_v = 0;
-    d->size_f = 0;
+    d->vars = (struct table){ NULL, 0, 0, 0 };
+    d->funcs = (struct table){ NULL, 0, 0, 0 };
     d->continuef = 0;
     d->breakf = 0;
-    d->nb_arg = 1;
-    d->func = malloc(100);
+    d->status = 0;
+    d->pid = getpid();
+    d->last_bg = 0;
+    d->top = (struct frame){ 0, NULL, NULL };
+    d->frame = &d->top;
+    d->scratch = (struct builder){ NULL, 0, 0 };
+    d->nesting = 0;
+    d->capture = NULL;
+    d->in_process = 0;
+    d->undo = NULL;
+    d->listings = (struct table){ NULL, 0, 0, 0 };
+    d->glob_cache = getenv(GLOB_CACHE_ENV) != NULL;
+    d->vm = getenv(VM_ENV) != NULL;
+    d->debug_optimize = getenv(OPTIMIZE_DEBUG_ENV) != NULL;
     return d;
 }
 
+static void free_var(struct key_value *var)
+{
+    free(var->entry.key);
+    free(var->value);
+    free(var);
+}
+
+static void release_body(struct func_body *body)
+{
+    if (--body->refs)
+        return;
+    vm_free(body->code);
+    ast_free(body->ast);
+    free(body);
+}
+
+static void free_func(struct key_func *func)
+{
+    release_body(func->body);
+    free(func->entry.key);
+    free(func);
+}
+
 static void free_dico(struct dico *dictionary)
 {
-    for (size_t i = 0; i < dictionary->size_v; i++)
-    {
-        if (dictionary->entries[i])
-        {
-            free(dictionary->entries[i]->key);
-            if (dictionary->entries[i]->value)
-                free(dictionary->entries[i]->value);
-            free(dictionary->entries[i]);
-        }
-    }
-    for (size_t j = 0; j < dictionary->size_f; j++)
-    {
-        if (dictionary->func[j])
-        {
-            free(dictionary->func[j]->key);
-            free(dictionary->func[j]);
-        }
-    }
-    free(dictionary->entries);
-    free(dictionary->func);
+    size_t pos = 0;
+    struct table_entry *entry;
+    while ((entry = table_next(&dictionary->vars, &pos)))
+        free_var((struct key_value *)entry);
+    table_free(&dictionary->vars);
+    pos = 0;
+    while ((entry = table_next(&dictionary->funcs, &pos)))
+        free_func((struct key_func *)entry);
+    table_free(&dictionary->funcs);
+    builder_free(&dictionary->scratch);
+    free_listings(&dictionary->listings);
     free(dictionary);
 }
 
-static int findvar(struct dico *d, char *key)
+struct key_value *find_var(struct dico *d, const char *key)
+{
+    return (struct key_value *)table_find(&d->vars, key);
+}
+
+static struct key_value *assign(struct dico *var, const char *key,
+                                const char *value)
 {
-    for (size_t i = 0; i < d->size_v; i++)
+    struct key_value *entry = find_var(var, key);
+    if (!entry)
     {
-        if (d->entries[i] && strcmp(d->entries[i]->key, key) == 0)
-            return i;
+        entry = calloc(1, sizeof(struct key_value));
+        entry->entry.key = strdup(key);
+        table_insert(&var->vars, &entry->entry);
     }
-    return -1;
+    if (!value)
+    {
+        free(entry->value);
+        entry->value = NULL;
+        return entry;
+    }
+    size_t len = strlen(value) + 1;
+    entry->value = realloc(entry->value, len);
+    memcpy(entry->value, value, len);
+    return entry;
 }
 
-static void modifyvalue(struct dico *d, int i, const char *value)
+// A variable as it was before a substitution run in the shell changed it
+struct undo
 {
-    char *tmp = strdup(value);
-    char *tok = strtok(tmp, "=");
-    tok = strtok(NULL, "='");
-    d->entries[i]->value = realloc(d->entries[i]->value, strlen(tok) + 1);
-    strcpy(d->entries[i]->value, tok);
-    free(tmp);
+    char *key;
+    char *value; // NULL when it was not set
+    int existed; // Whether it was declared at all
+    int depth; // The substitution it belongs to, by nesting
+    struct undo *next;
+};
+
+// Saves a variable the first time the substitution in the shell changes it
+static void save_var(struct dico *var, const char *key)
+{
+    struct undo *undo = var->undo;
+    for (; undo && undo->depth == var->in_process; undo = undo->next)
+        if (!strcmp(undo->key, key))
+            return;
+    struct key_value *old = find_var(var, key);
+    undo = malloc(sizeof(struct undo));
+    undo->key = strdup(key);
+    undo->value = old && old->value ? strdup(old->value) : NULL;
+    undo->existed = old != NULL;
+    undo->depth = var->in_process;
+    undo->next = var->undo;
+    var->undo = undo;
 }
 
-static int findfunc(struct dico *d, char *key)
+// Puts back the variables the substitution in the shell changed
+static void restore_vars(struct dico *var)
 {
-    for (size_t j = 0; j < d->size_f; j++)
+    while (var->undo && var->undo->depth == var->in_process)
     {
-        if (d->func[j] && strcmp(d->func[j]->key, key) == 0)
-            return j;
+        struct undo *undo = var->undo;
+        var->undo = undo->next;
+        struct table_entry *entry = NULL;
+        if (undo->existed)
+            assign(var, undo->key, undo->value);
+        else if ((entry = table_remove(&var->vars, undo->key)))
+            free_var((struct key_value *)entry);
+        free(undo->key);
+        free(undo->value);
+        free(undo);
     }
-    return -1;
 }
 
-static void Addfunc(struct dico *dico, struct ast *ast)
+struct key_value *set_var(struct dico *var, const char *key,
+                          const char *value)
 {
-    int ind = findfunc(dico, ast->data[0]);
-    if (ind < 0)
-    {
-        dico->func[dico->size_f] = malloc(sizeof(struct key_func));
-        dico->func[dico->size_f]->key = calloc(1000, sizeof(char));
-        strcpy(dico->func[dico->size_f]->key, ast->data[0]);
-        dico->func[dico->size_f]->ast = ast->ast_list[0];
-        dico->size_f++;
-    }
-    else
-        dico->func[ind]->ast = ast->ast_list[0];
+    if (var->in_process)
+        save_var(var, key);
+    return assign(var, key, value);
 }
 
-static void Addvalue(struct dico *dictionary, const char *keyValue)
+static struct key_func *findfunc(struct dico *d, const char *key)
 {
-    char *tmp = strdup(keyValue);
-    char *token = strtok(tmp, "=");
-    if (token == NULL)
-        errx(1, "Invalid Format");
-    int ind = findvar(dictionary, token);
-    if (ind < 0)
-    {
-        dictionary->entries[dictionary->size_v] =
-            malloc(sizeof(struct key_value));
-        dictionary->entries[dictionary->size_v]->key =
-            calloc(1000, sizeof(char));
-        strcpy(dictionary->entries[dictionary->size_v]->key, token);
-        token = strtok(NULL, "=");
-        if (token == NULL
-            && strcmp(dictionary->entries[dictionary->size_v]->key, "OLDPWD"))
-        {
-            errx(1, "Invalid key/value");
-            free(dictionary->entries[dictionary->size_v]->key);
-        }
-        dictionary->entries[dictionary->size_v]->value =
-            calloc(1000, sizeof(char));
-        strcpy(dictionary->entries[dictionary->size_v]->value, token);
-        dictionary->entries[dictionary->size_v]->arg = 0;
-        dictionary->size_v++;
-    }
-    else
-        modifyvalue(dictionary, ind, keyValue);
-    free(tmp);
+    return (struct key_func *)table_find(&d->funcs, key);
 }
 
-static void Addarg(struct dico *d, struct ast *ast)
+/*
+ * Defines the function with a copy of its body, so that it outlives the
+ * command that defined it, which is freed once it has run.
+ */
+static void Addfunc(struct dico *dico, struct ast *ast)
 {
-    if (ast->nb_data > 1)
+    struct func_body *body = malloc(sizeof(struct func_body));
+    body->ast = ast_copy(ast->ast_list[0]);
+    body->code = NULL;
+    body->refs = 1;
+    body->visiting = 0;
+    struct key_func *func = findfunc(dico, ast->data[0]);
+    if (func)
     {
-        char big[1000] = { "@=" };
-        for (int i = 1; i < ast->nb_data; i++)
-        {
-            char buff[100];
-            sprintf(buff, "%d=%s", d->nb_arg, ast->data[i]);
-            Addvalue(d, buff);
-            d->entries[d->size_v - 1]->arg = 1;
-            d->nb_arg++;
-            if (i == 1)
-                strcat(big, ast->data[i]);
-            else
-                strcat(strcat(big, " "), ast->data[i]);
-        }
-        Addvalue(d, big);
-        d->entries[d->size_v - 1]->arg = 1;
+        release_body(func->body);
+        func->body = body;
+        return;
     }
+    func = malloc(sizeof(struct key_func));
+    func->entry.key = strdup(ast->data[0]);
+    func->body = body;
+    table_insert(&dico->funcs, &func->entry);
 }
 
-static void add_init(struct dico *var)
+// Sets a variable from an assignment word, key=value, expanding the value
+static void Addvalue(struct dico *dictionary, const char *keyValue)
 {
-    char buff[100];
-    char *t = getcwd(buff, 100);
-    char tmp[100];
-    char tmp2[100];
-    sprintf(tmp, "%s=%s", "PWD", t);
-    sprintf(tmp2, "%s=%d", "?", 0);
-    Addvalue(var, tmp);
-    var->entries[1] = malloc(sizeof(struct key_value));
-    var->entries[1]->key = calloc(1000, sizeof(char));
-    strcpy(var->entries[1]->key, "OLDPWD");
-    var->entries[1]->value = NULL;
-    var->entries[1]->arg = 0;
-    var->size_v++;
-    Addvalue(var, tmp2);
+    const char *equal = strchr(keyValue, '=');
+    if (!equal || equal == keyValue)
+        errx(1, "Invalid Format");
+    char *key = strndup(keyValue, equal - keyValue);
+    char *value = word_expands(equal + 1) ? expand_word(equal + 1, dictionary)
+                                          : NULL;
+    set_var(dictionary, key, value ? value : equal + 1);
+    free(value);
+    free(key);
 }
 
-static struct ast *expansion(struct ast *ast, struct dico *var)
+static void add_init(struct dico *var)
 {
-    for (int i = 0; i < ast->nb_data; i++)
-    {
-        if (ast->data[i][0] == '$')
-        {
-            char off = 1;
-            if (ast->data[i][1] == '{')
-            {
-                ast->data[i][strlen(ast->data[i]) - 1] = 0;
-                off++;
-            }
-            int index = findvar(var, (ast->data[i] + off));
-            if (index == -1)
-            {
-                free(ast->data[i]);
-                ast->data[i] = NULL;
-                continue;
-            }
-            free(ast->data[i]);
-            if (strcmp(var->entries[index]->key, "OLDPWD") == 0
-                && var->entries[index]->value == NULL)
-            {
-                ast->data[i] = calloc(1, 5);
-                ast->data[i] = strcpy(ast->data[i], "");
-            }
-            else
-            {
-                ast->data[i] = calloc(strlen(var->entries[index]->value) + 1,
-                                      sizeof(char));
-                ast->data[i] = strcpy(ast->data[i], var->entries[index]->value);
-            }
-        }
-    }
-    return ast;
+    char buff[PATH_MAX];
+    set_var(var, "PWD", getcwd(buff, sizeof(buff)) ? buff : "");
+    set_var(var, "OLDPWD", NULL);
 }
 
 static int exec_c(struct ast *ast)
 {
-    ast->data = realloc(ast->data, (ast->nb_data + 1) * sizeof(char *));
-    ast->data[ast->nb_data] = NULL;
     pid_t pid = fork();
     if (pid == -1)
         errx(1, "fork");
@@ -311,33 +265,60 @@ static int exec_c(struct ast *ast)
     return 0;
 }
 
-static void echo_ex(int *i, size_t *j, struct ast *ast)
+/*
+ * Where builtins write: standard output, or the buffer of the command
+ * substitution running in the shell.
+ */
+static void output(struct dico *var, const char *s, size_t len)
+{
+    if (var->capture)
+    {
+        builder_put(var->capture, s, len);
+        return;
+    }
+    while (len)
+    {
+        ssize_t n = write(STDOUT_FILENO, s, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        s += n;
+        len -= n;
+    }
+}
+
+// Writes an escape, or the bytes up to the next one
+static void echo_ex(int *i, size_t *j, struct ast *ast, struct dico *var)
 {
-    if (ast->data[*i][*j] == '\\' && ast->data[*i][*j + 1])
+    const char *word = ast->data[*i];
+    if (word[*j] == '\\' && word[*j + 1])
     {
         *j += 1;
-        switch (ast->data[*i][*j])
+        switch (word[*j])
         {
         case 'n':
-            dprintf(global_fd, "\n");
+            output(var, "\n", 1);
             break;
         case 't':
-            dprintf(global_fd, "\t");
+            output(var, "\t", 1);
             break;
         default:
-            dprintf(global_fd, "\\%c", ast->data[*i][*j]);
+            output(var, "\\", 1);
+            output(var, word + *j, 1);
             break;
         }
         *j += 1;
     }
     else
     {
-        dprintf(global_fd, "%c", ast->data[*i][*j]);
-        *j += 1;
+        size_t n = strcspn(word + *j + 1, "\\") + 1;
+        output(var, word + *j, n);
+        *j += n;
     }
 }
 
-static void builtinEcho(struct ast *ast)
+static void builtinEcho(struct ast *ast, struct dico *var)
 {
     int flag_newline = 1;
     int flag_escape = 1;
@@ -357,10 +338,9 @@ static void builtinEcho(struct ast *ast)
             flag_escape = 0;
             break;
         default:
-            if (ast->nb_data == 2)
-                dprintf(1, "%s", ast->data[1]);
-            else
-                dprintf(1, "%s ", ast->data[1]);
+            output(var, ast->data[1], strlen(ast->data[1]));
+            if (ast->nb_data > 2)
+                output(var, " ", 1);
         }
     }
     while (i < ast->nb_data)
@@ -371,21 +351,21 @@ static void builtinEcho(struct ast *ast)
             {
                 size_t j = 0;
                 while (j < strlen(ast->data[i]))
-                    echo_ex(&i, &j, ast);
+                    echo_ex(&i, &j, ast, var);
             }
             else
             {
-                dprintf(1, "%s", ast->data[i]);
+                output(var, ast->data[i], strlen(ast->data[i]));
             }
             i++;
             if (i < ast->nb_data)
-                dprintf(global_fd, " ");
+                output(var, " ", 1);
         }
         else
             i++;
     }
     if (flag_newline)
-        dprintf(global_fd, "\n");
+        output(var, "\n", 1);
     fflush(stdout);
 }
 
@@ -404,100 +384,41 @@ static int true_false(struct ast *ast)
     return 0;
 }
 
+// Moves PWD to OLDPWD and sets PWD to the directory cd went to
+static void update_pwd(struct dico *d)
+{
+    struct key_value *pwd = find_var(d, "PWD");
+    set_var(d, "OLDPWD", pwd && pwd->value ? pwd->value : "");
+    char buff[PATH_MAX];
+    set_var(d, "PWD", getcwd(buff, sizeof(buff)) ? buff : "");
+}
+
 static int mycd(struct ast *ast, struct dico *d)
 {
     int res = 0;
-    char buff[100];
     if (ast->nb_data == 1)
-    {
         res = chdir("/root");
-        if (!res)
-        {
-            char tmp[100];
-            sprintf(tmp, "%s=%s", "OLDPWD", d->entries[0]->value);
-            Addvalue(d, tmp);
-            //==
-            char yolo[100];
-            sprintf(yolo, "%s=%s", "PWD", getcwd(buff, 100));
-            modifyvalue(d, 0, yolo);
-        }
-    }
     else if (ast->data[1][0] == '-')
     {
-        if (!d->entries[1]->value)
+        struct key_value *oldpwd = find_var(d, "OLDPWD");
+        if (!oldpwd || !oldpwd->value)
         {
             dprintf(2, "OLDPWD set to null\n");
             return 1;
         }
-        res = chdir(d->entries[1]->value);
-        if (!res)
-        {
-            char tmp[100];
-            sprintf(tmp, "%s=%s", "OLDPWD", d->entries[0]->value);
-            Addvalue(d, tmp);
-            //==
-            char yolo[100];
-            sprintf(yolo, "%s=%s", "PWD", getcwd(buff, 100));
-            modifyvalue(d, 0, yolo);
-        }
+        res = chdir(oldpwd->value);
     }
     else
-    {
         res = chdir(ast->data[1]);
-        if (!res)
-        {
-            char tmp[100];
-            sprintf(tmp, "%s=%s", "OLDPWD", d->entries[0]->value);
-            Addvalue(d, tmp);
-            //==
-            char yolo[100];
-            sprintf(yolo, "%s=%s", "PWD", getcwd(buff, 100));
-            modifyvalue(d, 0, yolo);
-        }
-    }
     if (res)
     {
         dprintf(2, "cd: %s: No such file or directory\n", ast->data[1]);
         return 1;
     }
+    update_pwd(d);
     return res;
 }
 
-static char **deepcopy(char **original, size_t size)
-{
-    if (original == NULL || size == 0)
-    {
-        return NULL;
-    }
-    char **copy = malloc(size * sizeof(char *));
-    if (copy == NULL)
-    {
-        return NULL;
-    }
-    for (size_t i = 0; i < size; ++i)
-    {
-        if (original[i] != NULL)
-        {
-            copy[i] = strdup(original[i]);
-            if (copy[i] == NULL)
-            {
-                for (size_t j = 0; j < i; ++j)
-                {
-                    free(copy[j]);
-                    free(original[j]);
-                }
-                free(copy);
-                return NULL;
-            }
-        }
-        else
-        {
-            copy[i] = NULL;
-        }
-    }
-    return copy;
-}
-
 static int my_exit(unsigned int n)
 {
     if (n <= 255)
@@ -513,37 +434,21 @@ static int my_unset(char *key, struct dico *var, int mode)
 {
     if (mode == 1)
     {
-        int i = findvar(var, key);
-        if (i == -1)
-            return i;
-        else
-        {
-            free(var->entries[i]->key);
-            if (var->entries[i]->value)
-                free(var->entries[i]->value);
-        }
-        free(var->entries[i]);
-        var->entries[i] = NULL;
+        struct table_entry *entry = table_remove(&var->vars, key);
+        if (!entry)
+            return -1;
+        free_var((struct key_value *)entry);
     }
     else
     {
-        int j = findfunc(var, key);
-        if (j == -1)
+        struct table_entry *entry = table_remove(&var->funcs, key);
+        if (!entry)
             return -2;
-        else
-        {
-            var->func[j]->ast = NULL;
-        }
+        free_func((struct key_func *)entry);
     }
     return 0;
 }
 
-static void imple(struct ast *ast, char **tmp)
-{
-    data_free(ast);
-    ast->data = tmp;
-}
-
 static int handle_unset(struct ast *ast, struct dico *var)
 {
     int res = 0;
@@ -567,81 +472,125 @@ static int handle_unset(struct ast *ast, struct dico *var)
     return res;
 }
 
-static void delete_arg(struct dico *var)
+/*
+ * The words after the name of the function become its positional parameters
+ * for the time of the call, in a frame that points to them. The body is held
+ * while it runs, as the function may be redefined meanwhile.
+ */
+static int eval_func(struct ast *ast, struct key_func *func, struct dico *var)
 {
-    for (size_t i = 0; i < var->size_v; i++)
+    struct frame frame = { ast->nb_data - 1, ast->data + 1, var->frame };
+    var->frame = &frame;
+    struct func_body *body = func->body;
+    body->refs++;
+    if (var->vm && !body->code)
+        body->code = vm_compile(body->ast);
+    int res = var->vm ? vm_run(body->code, var) : ast_evaluate(body->ast, var);
+    release_body(body);
+    var->frame = frame.caller;
+    return res;
+}
+
+// Drops the first n positional parameters, 1 by default
+static int shift(struct ast *ast, struct dico *var)
+{
+    int n = ast->nb_data > 1 && ast->data[1] ? atoi(ast->data[1]) : 1;
+    if (n < 0 || n > var->frame->argc)
     {
-        if (var->entries[i]->arg == 1)
-        {
-            my_unset(var->entries[i]->key, var, 1);
-        }
+        fprintf(stderr, "shift: shift count out of range\n");
+        return 1;
     }
+    var->frame->argc -= n;
+    var->frame->argv += n;
+    return 0;
 }
 
-static int eval_func(struct ast *ast, int ind, struct dico *func)
+enum builtin builtin_of(const char *name)
 {
-    Addarg(func, ast);
-    int res2 = ast_evaluate(func->func[ind]->ast, func);
-    delete_arg(func);
-    return res2;
+    static const char *names[] = {
+        [BUILTIN_ECHO] = "echo",
+        [BUILTIN_TRUE] = "true",
+        [BUILTIN_FALSE] = "false",
+        [BUILTIN_CD] = "cd",
+        [BUILTIN_CONTINUE] = "continue",
+        [BUILTIN_BREAK] = "break",
+        [BUILTIN_EXIT] = "exit",
+        [BUILTIN_DOT] = ".",
+        [BUILTIN_UNSET] = "unset",
+        [BUILTIN_SHIFT] = "shift",
+    };
+    for (size_t i = BUILTIN_ECHO; i < sizeof(names) / sizeof(*names); i++)
+        if (!strcmp(name, names[i]))
+            return i;
+    return BUILTIN_NONE;
 }
 
-static int command(struct ast *ast, struct dico *var)
+/*
+ * Builtins and commands run on a copy of the node holding the fields its
+ * words expand to. A command whose words all expand to nothing does nothing.
+ */
+int evaluate_command(struct ast *ast, enum builtin builtin, struct dico *var)
 {
-    char **tmp = deepcopy(ast->data, ast->nb_data);
     char *endptr;
-    int ind;
-    ast = expansion(ast, var);
-    if (strcmp(ast->data[0], "echo") == 0)
-        builtinEcho(ast);
-    else if (strcmp(ast->data[0], "true") == 0
-             || strcmp(ast->data[0], "false") == 0)
+    struct key_func *func;
+    int res = 0;
+    struct ast cmd = *ast;
+    cmd.data = expand_argv(ast, 0, var, &cmd.nb_data);
+    if (!cmd.nb_data)
     {
-        imple(ast, tmp);
-        return true_false(ast);
+        free_argv(ast, 0, cmd.data);
+        return 0;
     }
-    else if (!strcmp(ast->data[0], "cd"))
+    if (builtin == BUILTIN_UNKNOWN)
+        builtin = builtin_of(cmd.data[0]);
+    switch (builtin)
     {
-        imple(ast, tmp);
-        return mycd(ast, var);
-    }
-    else if (!strcmp(ast->data[0], "continue"))
+    case BUILTIN_ECHO:
+        builtinEcho(&cmd, var);
+        break;
+    case BUILTIN_TRUE:
+    case BUILTIN_FALSE:
+        res = true_false(&cmd);
+        break;
+    case BUILTIN_CD:
+        res = mycd(&cmd, var);
+        break;
+    case BUILTIN_CONTINUE:
         var->continuef =
-            ast->nb_data == 2 ? strtol(ast->data[1], &endptr, 10) : 1;
-    else if (!strcmp(ast->data[0], "break"))
-        var->breakf =
-            (ast->nb_data == 2) ? strtol(ast->data[1], &endptr, 10) : 1;
-    else if (!strcmp(ast->data[0], "exit"))
-    {
+            cmd.nb_data == 2 ? strtol(cmd.data[1], &endptr, 10) : 1;
+        break;
+    case BUILTIN_BREAK:
+        var->breakf = (cmd.nb_data == 2) ? strtol(cmd.data[1], &endptr, 10) : 1;
+        break;
+    case BUILTIN_EXIT: {
         char *inte;
-        int code = (ast->nb_data == 2) ? strtol(ast->data[1], &inte, 10) : 0;
+        int code = (cmd.nb_data == 2) ? strtol(cmd.data[1], &inte, 10) : 0;
+        free_argv(ast, 0, cmd.data);
         return my_exit(code);
     }
-    else if (!strcmp(ast->data[0], "."))
-    {
-        imple(ast, tmp);
-        return eval_dot(ast);
-    }
-    else if (!strcmp(ast->data[0], "unset"))
-    {
-        int res1 = handle_unset(ast, var);
-        imple(ast, tmp);
-        return res1;
-    }
-    else if ((ind = findfunc(var, ast->data[0])) >= 0)
-    {
-        int res2 = eval_func(ast, ind, var);
-        imple(ast, tmp);
-        return res2;
-    }
-    else
-    {
-        int res = exec_c(ast);
-        imple(ast, tmp);
-        return res;
+    case BUILTIN_DOT:
+        res = eval_dot(&cmd, var);
+        break;
+    case BUILTIN_UNSET:
+        res = handle_unset(&cmd, var);
+        break;
+    case BUILTIN_SHIFT:
+        res = shift(&cmd, var);
+        break;
+    default:
+        if ((func = findfunc(var, cmd.data[0])))
+            res = eval_func(&cmd, func, var);
+        else
+            res = exec_c(&cmd);
+        break;
     }
-    imple(ast, tmp);
-    return 0;
+    free_argv(ast, 0, cmd.data);
+    return res;
+}
+
+void set_status(struct dico *var, int res)
+{
+    var->status = res;
 }
 
 static int mypipe(struct ast *ast, struct dico *var)
@@ -701,12 +650,11 @@ static int mypipe(struct ast *ast, struct dico *var)
 static int my_for(struct ast *ast, struct dico *var)
 {
     int res = 0;
-    char *tmp = malloc(10000);
-    char *key = strdup(ast->data[0]);
-    for (int i = 1; i < ast->nb_data; i++)
+    int nb = 0;
+    char **words = expand_argv(ast, 1, var, &nb);
+    for (int i = 0; i < nb; i++)
     {
-        snprintf(tmp, 10000, "%s=%s", key, ast->data[i]);
-        Addvalue(var, tmp);
+        set_var(var, ast->data[0], words[i]);
         res = ast_evaluate(ast->ast_list[0], var);
         if (var->continuef)
         {
@@ -719,8 +667,7 @@ static int my_for(struct ast *ast, struct dico *var)
             break;
         }
     }
-    free(key);
-    free(tmp);
+    free_argv(ast, 1, words);
     return res;
 }
 
@@ -816,7 +763,7 @@ static int step(struct ast *ast, int flags, int stream, struct dico *var)
     if (ast->nb_ast && ast->ast_list[0]->data)
         res = ast_evaluate(ast->ast_list[0], var);
     fflush(NULL);
-    dup2(safe, 1);
+    dup2(safe, stream);
     close(safe);
     close(global_fd);
     global_fd = 1;
@@ -832,7 +779,7 @@ static int ETSI(struct ast *ast, int flags, int stream, struct dico *var)
     if (ast->nb_ast && ast->ast_list[0]->data)
         res = ast_evaluate(ast->ast_list[0], var);
     fflush(NULL);
-    dup2(safe, 1);
+    dup2(safe, stream);
     dup2(safe2, 2);
     close(safe);
     close(safe2);
@@ -841,7 +788,7 @@ static int ETSI(struct ast *ast, int flags, int stream, struct dico *var)
     return res;
 }
 
-static int eval_redir(struct ast *ast, struct dico *var)
+static int redirect(struct ast *ast, struct dico *var)
 {
     int res = 0;
     if (ast->nb_data != 2)
@@ -888,6 +835,19 @@ static int eval_redir(struct ast *ast, struct dico *var)
     return res;
 }
 
+// The file of a redirection is expanded as a single word
+static int eval_redir(struct ast *ast, struct dico *var)
+{
+    if (ast->nb_data != 2 || !ast->expand)
+        return redirect(ast, var);
+    struct ast redir = *ast;
+    char *words[3] = { ast->data[0], expand_word(ast->data[1], var), NULL };
+    redir.data = words;
+    int res = redirect(&redir, var);
+    free(words[1]);
+    return res;
+}
+
 static int subshell(struct ast *ast, struct dico *var)
 {
     pid_t pid = fork();
@@ -957,7 +917,7 @@ int ast_evaluate(struct ast *ast, struct dico *var)
     switch (ast->type)
     {
     case AST_COMMAND:
-        res = command(ast, var);
+        res = evaluate_command(ast, BUILTIN_UNKNOWN, var);
         break;
     case AST_LIST:
         for (int i = 0; i < ast->nb_ast; i++)
@@ -988,9 +948,313 @@ int ast_evaluate(struct ast *ast, struct dico *var)
     default:
         return ast_evaluate_bis(ast, var, res);
     }
-    char res1[100];
-    sprintf(res1, "?=%d", res);
-    Addvalue(var, res1);
+    set_status(var, res);
+    return res;
+}
+
+/*
+ * Runs a complete command read at the top level, then frees it: functions
+ * keep a copy of their body. The tree comes flattened, as loops and
+ * functions walk it many times, and is compiled first when the VM is
+ * enabled.
+ */
+static int run_command(struct ast *ast, struct dico *var)
+{
+    int res = 0;
+    if (var->vm)
+    {
+        struct program *program = vm_compile(ast);
+        res = vm_run(program, var);
+        vm_free(program);
+    }
+    else
+        res = ast_evaluate(ast, var);
+    var->breakf = 0;
+    var->continuef = 0;
+    ast_free(ast);
+    return res;
+}
+
+// Skips the line continuations between commands, returns 0 at the end
+static int next_command(struct lexer *lexer)
+{
+    struct token token = lexer_peek(lexer);
+    while (token.type == TOKEN_BACKSLASH)
+    {
+        lexer_pop(lexer);
+        token = lexer_peek(lexer);
+    }
+    token_free(token);
+    return token.type != TOKEN_EOF;
+}
+
+// Runs the trees of a script parsed beforehand, or found in the cache
+static int run_cached(struct ast **cached, size_t nb, struct dico *var)
+{
+    int res = 0;
+    for (size_t i = 0; i < nb; i++)
+        res = run_command(cached[i], var);
+    free(cached);
+    return res;
+}
+
+/*
+ * Parses the commands left in lexer, optimized and flattened, into *trees
+ * and returns their number. Parsing stops at the first syntax error, which
+ * *failed tells, and keeps the commands before it.
+ */
+static int parse_commands(struct lexer *lexer, struct dico *var,
+                          struct ast ***trees, int *failed)
+{
+    int nb = 0;
+    *trees = NULL;
+    *failed = 0;
+    while (next_command(lexer))
+    {
+        lexer_discard(lexer);
+        struct ast *ast = NULL;
+        if (parse(&ast, lexer) != PARSER_OK)
+        {
+            *failed = 1;
+            break;
+        }
+        if (!ast)
+            continue;
+        *trees = realloc(*trees, (nb + 1) * sizeof(struct ast *));
+        (*trees)[nb++] = ast_flatten(ast_optimize(ast, var->debug_optimize));
+    }
+    return nb;
+}
+
+/*
+ * A script in the cache runs from its entry. Any other script in a file is
+ * parsed whole and its entry written before its first command runs, as a
+ * command may end the shell with exit or an error; a syntax error leaves no
+ * entry, and only the commands before it run.
+ */
+static int run_script(struct lexer *lexer, struct cache *cache,
+                      struct dico *var)
+{
+    size_t nb = 0;
+    struct ast **trees = cache_load(cache, &nb);
+    if (trees)
+    {
+        cache_free(cache);
+        return run_cached(trees, nb, var);
+    }
+    int failed = 0;
+    nb = parse_commands(lexer, var, &trees, &failed);
+    for (size_t i = 0; i < nb && !failed; i++)
+        cache_add(cache, trees[i]);
+    if (!failed)
+        cache_commit(cache);
+    cache_free(cache);
+    int res = run_cached(trees, nb, var);
+    return failed ? 2 : res;
+}
+
+/*
+ * Each top-level command is parsed, run and freed before the next one is
+ * parsed, so the first commands of a script run before the rest is read.
+ * A script in a file goes through run_script when the cache is enabled.
+ */
+static int run_lexer(struct lexer *lexer, struct dico *var)
+{
+    struct cache *cache =
+        lexer->mapped ? cache_new(lexer->input, lexer->len) : NULL;
+    if (cache)
+        return run_script(lexer, cache, var);
+    int res = 0;
+    while (next_command(lexer))
+    {
+        lexer_discard(lexer);
+        struct ast *ast = NULL;
+        if (parse(&ast, lexer) != PARSER_OK)
+            return 2;
+        ast = ast_flatten(ast_optimize(ast, var->debug_optimize));
+        if (ast)
+            res = run_command(ast, var);
+    }
+    return res;
+}
+
+/*
+ * Parses all the commands of a command substitution before any of them runs,
+ * as where they run depends on every one. Returns their number, or -1 on a
+ * syntax error. The lexer only skips the blanks after a token, so those
+ * before the first one, as in $( if ...), are skipped here.
+ */
+static int parse_all(const char *text, size_t len, struct dico *var,
+                     struct ast ***trees)
+{
+    while (len && memchr(" \t\n", *text, 3))
+    {
+        text++;
+        len--;
+    }
+    struct lexer *lexer = lexer_new(text, len);
+    int failed = 0;
+    int nb = parse_commands(lexer, var, trees, &failed);
+    lexer_free(lexer);
+    if (!failed)
+        return nb;
+    while (nb)
+        ast_free((*trees)[--nb]);
+    free(*trees);
+    return -1;
+}
+
+static int in_process(struct ast *ast, struct dico *var);
+
+/*
+ * A command runs in the shell when its name is written as is, and is a
+ * builtin that only writes or changes variables or a function whose body
+ * does as much. A function calling itself is only looked at once.
+ */
+static int command_in_process(struct ast *ast, struct dico *var)
+{
+    if (!ast->nb_data || word_expands(ast->data[0]))
+        return 0;
+    switch (builtin_of(ast->data[0]))
+    {
+    case BUILTIN_ECHO:
+    case BUILTIN_TRUE:
+    case BUILTIN_FALSE:
+    case BUILTIN_CONTINUE:
+    case BUILTIN_BREAK:
+        return 1;
+    case BUILTIN_NONE:
+        break;
+    default:
+        return 0;
+    }
+    struct key_func *func = findfunc(var, ast->data[0]);
+    if (!func)
+        return 0;
+    struct func_body *body = func->body;
+    if (body->visiting)
+        return 1;
+    body->visiting = 1;
+    int res = in_process(body->ast, var);
+    body->visiting = 0;
+    return res;
+}
+
+/*
+ * Programs, pipes, redirections and subshells need a process of their own,
+ * and a function defined by a substitution should not outlive it.
+ */
+static int in_process(struct ast *ast, struct dico *var)
+{
+    if (!ast)
+        return 1;
+    switch (ast->type)
+    {
+    case AST_COMMAND:
+        return command_in_process(ast, var);
+    case AST_PIPE:
+    case AST_REDIR:
+    case AST_SUBSHELL:
+    case AST_FUNCTION:
+        return 0;
+    default:
+        break;
+    }
+    for (int i = 0; i < ast->nb_ast; i++)
+        if (!in_process(ast->ast_list[i], var))
+            return 0;
+    return 1;
+}
+
+/*
+ * Runs the commands in the shell with what they write collected in output.
+ * The variables they set are restored afterwards, as they would be had they
+ * run in a child.
+ */
+static int run_in_process(struct ast **trees, int nb, struct dico *var,
+                          struct builder *output)
+{
+    struct builder *capture = var->capture;
+    int breakf = var->breakf;
+    int continuef = var->continuef;
+    var->capture = output;
+    var->in_process++;
+    int res = 0;
+    for (int i = 0; i < nb; i++)
+        res = run_command(trees[i], var);
+    restore_vars(var);
+    var->in_process--;
+    var->capture = capture;
+    var->breakf = breakf;
+    var->continuef = continuef;
+    return res;
+}
+
+/*
+ * Runs the commands in a child writing to a pipe, which is read straight
+ * into output as it grows.
+ */
+static int run_in_child(struct ast **trees, int nb, struct dico *var,
+                        struct builder *output)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+        errx(1, "pipe");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1)
+        errx(1, "fork");
+    if (!pid)
+    {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        global_fd = STDOUT_FILENO;
+        var->capture = NULL;
+        int res = 0;
+        for (int i = 0; i < nb; i++)
+            res = run_command(trees[i], var);
+        exit(res);
+    }
+    close(fds[1]);
+    for (int i = 0; i < nb; i++)
+        ast_free(trees[i]);
+    ssize_t n;
+    do
+    {
+        char *end = builder_reserve(output, SUBSTITUTE_READ);
+        n = read(fds[0], end, output->capacity - output->len);
+        if (n > 0)
+            output->len += n;
+    } while (n > 0 || (n == -1 && errno == EINTR));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int substitute(const char *text, size_t len, struct dico *var,
+               struct builder *output)
+{
+    struct ast **trees = NULL;
+    int nb = parse_all(text, len, var, &trees);
+    if (nb < 0)
+        errx(2, "command substitution: syntax error");
+    int inside = 1;
+    for (int i = 0; i < nb && inside; i++)
+        inside = in_process(trees[i], var);
+    int res = inside ? run_in_process(trees, nb, var, output)
+                     : run_in_child(trees, nb, var, output);
+    free(trees);
+    return res;
+}
+
+int evaluate_lexer(struct lexer *lexer)
+{
+    struct dico *variables = new_dico();
+    add_init(variables);
+    int res = run_lexer(lexer, variables);
+    free_dico(variables);
     return res;
 }
 
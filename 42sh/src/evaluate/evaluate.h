@@ -1,34 +1,134 @@
 #ifndef EVALUATE_H
 #define EVALUATE_H
 
+#include <sys/types.h>
+
 #include "../ast/ast.h"
+#include "../lexer/lexer.h"
+#include "expand.h"
+#include "table.h"
 
 struct key_value
 {
-    char *key;
-    char *value;
-    int arg;
+    struct table_entry entry; // Name of the variable
+    char *value; // NULL for a variable that is declared but not set
+};
+
+/*
+ * The body of a function, shared by the function and the calls running it,
+ * so that a function redefined or unset by its own body lives until the call
+ * returns.
+ */
+struct func_body
+{
+    struct ast *ast; // Copy of the body, owned
+    struct program *code; // Body compiled on the first call under the VM
+    size_t refs; // The function defined with it, and the calls running it
+    int visiting; // Whether it is being checked by a command substitution
 };
 
 struct key_func
 {
-    char *key;
-    struct ast *ast;
+    struct table_entry entry; // Name of the function
+    struct func_body *body;
 };
 
+// The positional parameters of a function call, pointing into its words
+struct frame
+{
+    int argc; // $#
+    char **argv; // $1 to $n, moved forward by shift
+    struct frame *caller; // Frame the call returns to, NULL at the top level
+};
+
+struct undo;
+
 struct dico
 {
-    struct key_value **entries;
-    struct key_func **func;
-    size_t size_v;
-    size_t size_f;
+    struct table vars; // Variables, of struct key_value
+    struct table funcs; // Functions, of struct key_func
     int continuef;
     int breakf;
-    int nb_arg;
+    int status; // $?, the status of the last command
+    pid_t pid; // $$, the process of the shell, kept in subshells
+    pid_t last_bg; // $!, the last command run in the background, 0 if none
+    struct frame *frame; // Parameters of the call being run
+    struct frame top; // Parameters outside of any call, which are empty
+    struct builder scratch; // Where words are expanded
+    int nesting; // Expansions open around the one being expanded
+    struct builder *capture; // Output of the substitution run in the shell
+    int in_process; // Substitutions run in the shell, nested
+    struct undo *undo; // How to restore the variables they changed
+    struct table listings; // Directories read by pathname expansion
+    int glob_cache; // Whether listings keeps them for the next expansions
+    int vm; // Whether commands run on the VM rather than the tree walker
+    int debug_optimize; // Whether to report what the optimizer removed
+};
+
+/*
+ * The builtins, resolved from the first word of a command. The VM resolves
+ * them when it compiles a command whose name is not expanded, the tree
+ * walker each time it runs one.
+ */
+enum builtin
+{
+    BUILTIN_UNKNOWN, // Not resolved yet
+    BUILTIN_NONE, // A function or a program
+    BUILTIN_ECHO,
+    BUILTIN_TRUE,
+    BUILTIN_FALSE,
+    BUILTIN_CD,
+    BUILTIN_CONTINUE,
+    BUILTIN_BREAK,
+    BUILTIN_EXIT,
+    BUILTIN_DOT,
+    BUILTIN_UNSET,
+    BUILTIN_SHIFT,
 };
 
+enum builtin builtin_of(const char *name);
+
+/**
+ * \brief Runs a simple command as builtin, which is resolved from its
+ * expanded name when BUILTIN_UNKNOWN.
+ */
+int evaluate_command(struct ast *ast, enum builtin builtin, struct dico *var);
+
+/**
+ * \brief Stores res in $?, which is only formatted when it is expanded.
+ */
+void set_status(struct dico *var, int res);
+
+/**
+ * \brief Returns the variable key, or NULL when it was never set.
+ */
+struct key_value *find_var(struct dico *var, const char *key);
+
+/**
+ * \brief Sets the variable key to value, which may be NULL, and returns the
+ * variable. It stays at the same address until it is unset.
+ */
+struct key_value *set_var(struct dico *var, const char *key,
+                          const char *value);
+
+/**
+ * \brief Runs the len bytes of command at text for a command substitution,
+ * appends what it writes to output, and returns its status. Commands made of
+ * builtins and functions that only write and set variables run in the
+ * shell, which then restores the variables; the others run in a child whose
+ * output is read from a pipe. Exits with status 2 on a syntax error.
+ */
+int substitute(const char *text, size_t len, struct dico *var,
+               struct builder *output);
+
 int evaluate(struct ast *ast);
 
+/**
+ * \brief Parses and evaluates the commands the lexer produces one at a time,
+ * as for a script given to 42sh. Stops with 2 on a syntax error.
+ */
+int evaluate_lexer(struct lexer *lexer);
+
 int ast_evaluate(struct ast *ast, struct dico *d);
 
 #endif /* !EVALUATE_H */
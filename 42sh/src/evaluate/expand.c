@@ -0,0 +1,928 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "expand.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "evaluate.h"
+#include "match.h"
+#include "pathname.h"
+
+#define IFS_DEFAULT " \t\n"
+#define IFS_SPACE " \t\n"
+
+char *builder_reserve(struct builder *builder, size_t len)
+{
+    if (builder->len + len > builder->capacity)
+    {
+        size_t capacity = builder->capacity ? builder->capacity : 256;
+        while (builder->len + len > capacity)
+            capacity *= 2;
+        builder->data = realloc(builder->data, capacity);
+        if (!builder->data)
+            errx(1, "expand: out of memory");
+        builder->capacity = capacity;
+    }
+    return builder->data + builder->len;
+}
+
+void builder_put(struct builder *builder, const char *s, size_t len)
+{
+    if (!len)
+        return;
+    memcpy(builder_reserve(builder, len), s, len);
+    builder->len += len;
+}
+
+void builder_free(struct builder *builder)
+{
+    free(builder->data);
+    builder->data = NULL;
+    builder->len = 0;
+    builder->capacity = 0;
+}
+
+/*
+ * The words being expanded. Their fields are written one after the other in
+ * out, each followed by a NUL. A field is open as soon as something was
+ * written for it, even nothing from quotes: "" makes an empty field, while
+ * an unquoted expansion to nothing makes none.
+ */
+struct state
+{
+    struct dico *var;
+    struct builder *out; // The scratch buffer of the shell
+    const char *ifs; // Bytes unquoted expansions are split on
+    int split; // Whether to split into fields at all
+    int pattern; // Whether quoted bytes are escaped, as for a pattern
+    int glob; // Whether the field holds an unquoted *, ? or [
+    int escaped; // Whether a backslash was added to the field
+    int open; // Whether a field is being written
+    size_t start; // Offset of the field being written
+    int after_space; // Whether IFS white space just ended a field
+    int drop; // Whether an empty field comes from "$@" alone, and goes
+    int nb; // Fields ended
+};
+
+/*
+ * Fields that are split are patterns as well, for pathname expansion: the
+ * unquoted bytes are written as they are but for backslashes, which only
+ * quoting makes.
+ */
+static void put_pattern(struct state *st, const char *s, size_t len)
+{
+    size_t from = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[')
+            st->glob = 1;
+        else if (s[i] == '\\')
+        {
+            builder_put(st->out, s + from, i - from);
+            builder_put(st->out, "\\", 1);
+            from = i;
+            st->escaped = 1;
+        }
+    }
+    builder_put(st->out, s + from, len - from);
+}
+
+static void put(struct state *st, const char *s, size_t len)
+{
+    if (st->pattern && st->split)
+        put_pattern(st, s, len);
+    else
+        builder_put(st->out, s, len);
+    st->open = 1;
+    st->after_space = 0;
+}
+
+// Writes quoted bytes, which a pattern only matches as they are
+static void put_quoted(struct state *st, const char *s, size_t len)
+{
+    if (!st->pattern)
+    {
+        put(st, s, len);
+        return;
+    }
+    put(st, "", 0);
+    for (size_t i = 0; i < len; i++)
+    {
+        if (strchr("*?[\\", s[i]))
+        {
+            builder_put(st->out, "\\", 1);
+            st->escaped = 1;
+        }
+        builder_put(st->out, s + i, 1);
+    }
+}
+
+// Removes the backslashes of the field being written, keeping what they escape
+static void unescape(struct state *st)
+{
+    char *data = st->out->data;
+    size_t to = st->start;
+    for (size_t i = st->start; i < st->out->len; i++)
+    {
+        if (data[i] == '\\' && i + 1 < st->out->len)
+            i++;
+        data[to++] = data[i];
+    }
+    st->out->len = to;
+}
+
+/*
+ * A field written as a pattern is replaced by the paths it matches, and
+ * stays as written, its escapes removed, when there are none. Returns the
+ * number of fields it made.
+ */
+static int end_pattern(struct state *st)
+{
+    int nb = 0;
+    if (st->glob)
+    {
+        struct dico *var = st->var;
+        struct builder paths = { NULL, 0, 0 };
+        builder_put(st->out, "", 1);
+        nb = expand_pathname(st->out->data + st->start,
+                             var->glob_cache ? &var->listings : NULL, &paths);
+        st->out->len--;
+        if (nb)
+        {
+            st->out->len = st->start;
+            builder_put(st->out, paths.data, paths.len);
+        }
+        builder_free(&paths);
+    }
+    if (!nb && st->escaped)
+        unescape(st);
+    st->glob = 0;
+    st->escaped = 0;
+    return nb;
+}
+
+static void end_field(struct state *st)
+{
+    int nb = st->pattern ? end_pattern(st) : 0;
+    if (!nb)
+    {
+        builder_put(st->out, "", 1);
+        nb = 1;
+    }
+    st->open = 0;
+    st->start = st->out->len;
+    st->nb += nb;
+}
+
+/*
+ * Writes the len bytes an expansion produced. Unquoted, they are split on
+ * IFS: white space only separates fields, while any other byte of IFS ends
+ * one, even empty, together with the white space around it.
+ */
+static void put_value(struct state *st, const char *value, size_t len,
+                      int quoted)
+{
+    if (quoted)
+    {
+        put_quoted(st, value, len);
+        return;
+    }
+    if (!st->split)
+    {
+        put(st, value, len);
+        return;
+    }
+    const char *end = value + len;
+    while (value < end)
+    {
+        const char *p = value;
+        while (p < end && !strchr(st->ifs, *p))
+            p++;
+        if (p > value)
+            put(st, value, p - value);
+        value = p;
+        if (value == end)
+            break;
+        if (strchr(IFS_SPACE, *value))
+        {
+            if (st->open)
+            {
+                end_field(st);
+                st->after_space = 1;
+            }
+        }
+        else
+        {
+            if (st->open || !st->after_space)
+                end_field(st);
+            st->after_space = 0;
+        }
+        value++;
+    }
+}
+
+/*
+ * $@ and $* give each parameter its own field, except in double quotes where
+ * $* joins them with the first byte of IFS. "$@" without parameters makes no
+ * field at all.
+ */
+static void put_params(struct state *st, char c, int quoted)
+{
+    const struct frame *frame = st->var->frame;
+    for (int i = 0; i < frame->argc; i++)
+    {
+        if (i && (!st->split || (quoted && c == '*')))
+        {
+            if (st->split && st->ifs[0])
+                put(st, st->ifs, 1);
+            else if (!st->split)
+                put(st, " ", 1);
+        }
+        else if (i && (quoted || st->open))
+            end_field(st);
+        if (frame->argv[i])
+            put_value(st, frame->argv[i], strlen(frame->argv[i]), quoted);
+    }
+    if (quoted && c == '@' && !frame->argc)
+        st->drop = 1;
+}
+
+/*
+ * $@ and $* as a single string, for the operators: the parameters joined
+ * with spaces in *joined, which is to be freed. NULL without parameters.
+ */
+static const char *join_params(const struct frame *frame, char **joined)
+{
+    if (!frame->argc)
+        return NULL;
+    size_t len = 0;
+    for (int i = 0; i < frame->argc; i++)
+        len += (frame->argv[i] ? strlen(frame->argv[i]) : 0) + 1;
+    char *res = malloc(len);
+    if (!res)
+        errx(1, "expand: out of memory");
+    char *p = res;
+    for (int i = 0; i < frame->argc; i++)
+    {
+        if (i)
+            *p++ = ' ';
+        if (frame->argv[i])
+            p = stpcpy(p, frame->argv[i]);
+    }
+    *p = '\0';
+    *joined = res;
+    return res;
+}
+
+// The special parameters live in fields of the dico, and are formatted here
+static const char *special(struct state *st, char c, char *buff,
+                           char **joined)
+{
+    const struct dico *var = st->var;
+    switch (c)
+    {
+    case '@':
+    case '*':
+        return join_params(var->frame, joined);
+    case '?':
+        sprintf(buff, "%d", var->status);
+        break;
+    case '#':
+        sprintf(buff, "%d", var->frame->argc);
+        break;
+    case '$':
+        sprintf(buff, "%ld", (long)var->pid);
+        break;
+    case '!':
+        if (!var->last_bg)
+            return NULL;
+        sprintf(buff, "%ld", (long)var->last_bg);
+        break;
+    default:
+        strcpy(buff, "42sh");
+        break;
+    }
+    return buff;
+}
+
+/*
+ * Returns the value of the parameter whose name is the len bytes at name, or
+ * NULL when it is not set. A variable is looked up with its name copied
+ * after the fields, where it is overwritten by what comes next.
+ */
+static const char *lookup(struct state *st, const char *name, size_t len,
+                          char *buff, char **joined)
+{
+    if (len == 1 && strchr("@*?#$!0", name[0]))
+        return special(st, name[0], buff, joined);
+    if (isdigit((unsigned char)name[0]))
+    {
+        long n = 0;
+        for (size_t i = 0; i < len && n <= INT_MAX; i++)
+            n = 10 * n + name[i] - '0';
+        const struct frame *frame = st->var->frame;
+        return n >= 1 && n <= frame->argc ? frame->argv[n - 1] : NULL;
+    }
+    size_t mark = st->out->len;
+    builder_put(st->out, name, len);
+    builder_put(st->out, "", 1);
+    struct key_value *value = find_var(st->var, st->out->data + mark);
+    st->out->len = mark;
+    return value ? value->value : NULL;
+}
+
+static void put_parameter(struct state *st, const char *name, size_t len,
+                          int quoted)
+{
+    if (len == 1 && (name[0] == '@' || name[0] == '*'))
+    {
+        put_params(st, name[0], quoted);
+        return;
+    }
+    char buff[32];
+    const char *value = lookup(st, name, len, buff, NULL);
+    if (value)
+        put_value(st, value, strlen(value), quoted);
+}
+
+static int is_name(char c, int first)
+{
+    return isalpha((unsigned char)c) || c == '_'
+        || (!first && isdigit((unsigned char)c));
+}
+
+// The length of the parameter name at s, 0 if there is none
+static size_t name_length(const char *s, const char *end)
+{
+    size_t len = 0;
+    if (s < end && is_name(*s, 1))
+        while (s + len < end && is_name(s[len], 0))
+            len++;
+    else if (s < end && isdigit((unsigned char)*s))
+        while (s + len < end && isdigit((unsigned char)s[len]))
+            len++;
+    else if (s < end && strchr("@*?#$!", *s))
+        len = 1;
+    return len;
+}
+
+static const char *closing_brace(const char *p);
+static const char *closing_paren(const char *p, int arithmetic);
+
+// Returns the backquote that ends the command at p, or the end of the word
+static const char *closing_backquote(const char *p)
+{
+    while (*p && *p != '`')
+        p += *p == '\\' && p[1] ? 2 : 1;
+    return p;
+}
+
+/*
+ * Moves past the quoted text, the escaped byte, the backquoted command or the
+ * parameter at p, which may hold the bytes that close what is around them.
+ */
+static const char *skip(const char *p)
+{
+    if (*p == '\'')
+    {
+        const char *quote = strchr(p + 1, '\'');
+        return quote ? quote + 1 : p + strlen(p);
+    }
+    if (*p == '"')
+    {
+        for (p++; *p && *p != '"';)
+        {
+            p += strcspn(p, "\"\\$`");
+            if (*p && *p != '"')
+                p = skip(p);
+        }
+        return p + (*p != '\0');
+    }
+    if (*p == '\\')
+        return p + (p[1] ? 2 : 1);
+    if (*p == '`')
+    {
+        p = closing_backquote(p + 1);
+        return p + (*p != '\0');
+    }
+    if (p[1] == '{')
+    {
+        p = closing_brace(p + 2);
+        return p + (*p != '\0');
+    }
+    if (p[1] == '(')
+    {
+        int arithmetic = p[2] == '(';
+        p = closing_paren(p + 2 + arithmetic, arithmetic);
+        return p + (*p ? 1 + arithmetic : 0);
+    }
+    return p + 1;
+}
+
+/*
+ * Returns the } that closes the braces opened just before p, or the end of
+ * the word when there is none. It is looked for the way the lexer did, past
+ * quotes, backslashes and nested parameters.
+ */
+static const char *closing_brace(const char *p)
+{
+    while (*p && *p != '}')
+    {
+        p += strcspn(p, "}'\"\\$`");
+        if (*p && *p != '}')
+            p = skip(p);
+    }
+    return p;
+}
+
+/*
+ * Returns the ) that closes the command at p, or the first ) of the )) that
+ * closes the arithmetic expression at p, as closing_brace does.
+ */
+static const char *closing_paren(const char *p, int arithmetic)
+{
+    int depth = 0;
+    while (*p)
+    {
+        p += strcspn(p, "()'\"\\$`");
+        if (!*p || (*p == ')' && !depth && (!arithmetic || p[1] == ')')))
+            break;
+        if (*p == '(')
+            depth++;
+        else if (*p == ')' && depth)
+            depth--;
+        p = *p == '(' || *p == ')' ? p + 1 : skip(p);
+    }
+    return p;
+}
+
+// The bytes from p on that are not in stop, without going past end
+static size_t span(const char *p, const char *end, const char *stop)
+{
+    size_t n = strcspn(p, stop);
+    return p + n > end ? (size_t)(end - p) : n;
+}
+
+static const char *parameter(struct state *st, const char *p, int quoted);
+
+/*
+ * Opens an expansion inside the ones being expanded. Past EXPAND_MAX_DEPTH of
+ * them the shell stops, instead of letting the C stack overflow.
+ */
+static void enter(struct state *st)
+{
+    if (st->var->nesting >= EXPAND_MAX_DEPTH)
+        errx(1, "expand: nested deeper than %d levels", EXPAND_MAX_DEPTH);
+    st->var->nesting++;
+}
+
+// Writes the byte escaped by a backslash; a backslash and a newline vanish
+static const char *escaped(struct state *st, const char *p, const char *end)
+{
+    if (p == end)
+    {
+        put_quoted(st, "\\", 1);
+        return p;
+    }
+    if (*p != '\n')
+        put_quoted(st, p, 1);
+    return p + 1;
+}
+
+/*
+ * Writes the output of a command substitution, without its trailing
+ * newlines, and keeps its status for $?.
+ */
+static void put_substitution(struct state *st, const char *text, size_t len,
+                             int quoted)
+{
+    struct builder output = { NULL, 0, 0 };
+    st->var->status = substitute(text, len, st->var, &output);
+    while (output.len && output.data[output.len - 1] == '\n')
+        output.len--;
+    put_value(st, output.len ? output.data : "", output.len, quoted);
+    builder_free(&output);
+}
+
+/*
+ * Runs the command in backquotes at p, in which a backslash only escapes $,
+ * ` and \, and " as well in double quotes. Returns what follows the closing
+ * backquote.
+ */
+static const char *backquoted(struct state *st, const char *p,
+                              const char *end, int quoted)
+{
+    const char *close = closing_backquote(p);
+    if (close > end)
+        close = end;
+    char *text = malloc(close - p + 1);
+    if (!text)
+        errx(1, "expand: out of memory");
+    size_t len = 0;
+    for (const char *q = p; q < close; q++)
+    {
+        if (*q == '\\' && q + 1 < close
+            && strchr(quoted ? "$`\\\"" : "$`\\", q[1]))
+            q++;
+        text[len++] = *q;
+    }
+    enter(st);
+    put_substitution(st, text, len, quoted);
+    st->var->nesting--;
+    free(text);
+    return close < end ? close + 1 : close;
+}
+
+/*
+ * Expands the text in double quotes at p and returns what follows the
+ * closing quote. A backslash only escapes $, `, ", \ and a newline there.
+ * The word of an operator in double quotes is expanded the same way up to
+ * end, but its own double quotes are only removed.
+ */
+static const char *double_quoted(struct state *st, const char *p,
+                                 const char *end, int nested)
+{
+    put(st, "", 0);
+    while (p < end)
+    {
+        size_t n = span(p, end, "$\"\\`");
+        put_quoted(st, p, n);
+        p += n;
+        if (p == end)
+            break;
+        if (*p == '"' && !nested)
+            return p + 1;
+        if (*p == '"')
+            p++;
+        else if (*p == '\\' && p + 1 < end && strchr("$`\"\\\n", p[1]))
+            p = escaped(st, p + 1, end);
+        else if (*p == '\\')
+            put_quoted(st, p++, 1);
+        else if (*p == '`')
+            p = backquoted(st, p + 1, end, 1);
+        else
+            p = parameter(st, p + 1, 1);
+    }
+    return p;
+}
+
+static const char *single_quoted(struct state *st, const char *p,
+                                 const char *end)
+{
+    size_t n = span(p, end, "'");
+    put_quoted(st, p, n);
+    return p + n < end ? p + n + 1 : p + n;
+}
+
+/*
+ * Expands the unquoted text from p to end. The text written in the word of
+ * an operator is split like the values of parameters, when split_text says
+ * so.
+ */
+static void expand_text(struct state *st, const char *p, const char *end,
+                        int split_text)
+{
+    while (p < end)
+    {
+        size_t n = span(p, end, "$'\"\\`");
+        if (n && split_text)
+            put_value(st, p, n, 0);
+        else if (n)
+            put(st, p, n);
+        p += n;
+        if (p == end)
+            break;
+        if (*p == '\'')
+            p = single_quoted(st, p + 1, end);
+        else if (*p == '"')
+            p = double_quoted(st, p + 1, end, 0);
+        else if (*p == '\\')
+            p = escaped(st, p + 1, end);
+        else if (*p == '`')
+            p = backquoted(st, p + 1, end, 0);
+        else
+            p = parameter(st, p + 1, 0);
+    }
+}
+
+// Expands the word of an operator, as in double quotes if quoted
+static void put_word(struct state *st, const char *word, const char *end,
+                     int quoted)
+{
+    if (quoted)
+        double_quoted(st, word, end, 1);
+    else
+        expand_text(st, word, end, 1);
+}
+
+/*
+ * Expands the word of an operator into a string after the fields, and
+ * returns its offset. It is not split, and is a pattern when pattern says
+ * so, whether the parameter is quoted or not.
+ */
+static size_t word_string(struct state *st, const char *word, const char *end,
+                          int pattern)
+{
+    struct state sub = *st;
+    sub.split = 0;
+    sub.pattern = pattern;
+    size_t mark = st->out->len;
+    if (pattern)
+        expand_text(&sub, word, end, 0);
+    else
+        put_word(&sub, word, end, 0);
+    builder_put(st->out, "", 1);
+    return mark;
+}
+
+static void bad_substitution(const char *s, const char *end)
+{
+    errx(1, "${%.*s}: bad substitution", (int)(end - s), s);
+}
+
+/*
+ * Finds the bytes of value left once the shortest or longest prefix (#) or
+ * suffix (%) the pattern matches is removed. A pattern without special bytes
+ * is only compared.
+ */
+static void trim(const char *value, char op, int longest, const char *pattern,
+                 size_t *from, size_t *to)
+{
+    size_t len = strlen(value);
+    *from = 0;
+    *to = len;
+    if (!strpbrk(pattern, "*?[\\"))
+    {
+        size_t n = strlen(pattern);
+        if (n <= len && op == '#' && !memcmp(value, pattern, n))
+            *from = n;
+        else if (n <= len && op == '%' && !memcmp(value + len - n, pattern, n))
+            *to = len - n;
+        return;
+    }
+    for (size_t k = 0; k <= len; k++)
+    {
+        size_t i = (op == '#') == longest ? len - k : k;
+        if (op == '#' && match(pattern, value, i))
+        {
+            *from = i;
+            return;
+        }
+        if (op == '%' && match(pattern, value + i, len - i))
+        {
+            *to = i;
+            return;
+        }
+    }
+}
+
+// ${#name}, the length of the value of a parameter, or $# for $@ and $*
+static void put_length(struct state *st, const char *name, size_t len,
+                       int quoted)
+{
+    char buff[32];
+    char *joined = NULL;
+    long n = st->var->frame->argc;
+    if (len != 1 || (name[0] != '@' && name[0] != '*'))
+    {
+        const char *value = lookup(st, name, len, buff, &joined);
+        n = value ? (long)strlen(value) : 0;
+    }
+    sprintf(buff, "%ld", n);
+    put_value(st, buff, strlen(buff), quoted);
+}
+
+/*
+ * Expands the parameter in braces from s to end: a name, optionally followed
+ * by an operator and its word. With a colon, the operators that test whether
+ * the parameter is set also test whether it is empty.
+ */
+static void braced(struct state *st, const char *s, const char *end,
+                   int quoted)
+{
+    size_t len = name_length(s + 1, end);
+    if (*s == '#' && len && s + 1 + len == end)
+    {
+        put_length(st, s + 1, len, quoted);
+        return;
+    }
+    len = name_length(s, end);
+    if (!len)
+        bad_substitution(s, end);
+    const char *op = s + len;
+    if (op == end)
+    {
+        put_parameter(st, s, len, quoted);
+        return;
+    }
+    int colon = *op == ':';
+    op += colon;
+    if (op == end || !strchr(colon ? "-=?+" : "-=?+#%", *op))
+        bad_substitution(s, end);
+    int longest = (*op == '#' || *op == '%') && op + 1 < end && op[1] == *op;
+    const char *word = op + 1 + longest;
+    size_t pattern = 0;
+    if (*op == '#' || *op == '%')
+        pattern = word_string(st, word, end, 1);
+    char buff[32];
+    char *joined = NULL;
+    const char *value = lookup(st, s, len, buff, &joined);
+    int set = value && (!colon || *value);
+    if (*op == '#' || *op == '%')
+    {
+        size_t from = 0;
+        size_t to = 0;
+        if (value)
+            trim(value, *op, longest, st->out->data + pattern, &from, &to);
+        st->out->len = pattern;
+        if (value)
+            put_value(st, value + from, to - from, quoted);
+    }
+    else if ((*op == '-' && !set) || (*op == '+' && set))
+        put_word(st, word, end, quoted);
+    else if (*op == '=' && !set)
+    {
+        if (!is_name(*s, 1))
+            errx(1, "${%.*s}: cannot assign in this way", (int)len, s);
+        size_t text = word_string(st, word, end, 0);
+        size_t name = st->out->len;
+        builder_put(st->out, s, len);
+        builder_put(st->out, "", 1);
+        struct key_value *assigned = set_var(
+            st->var, st->out->data + name, st->out->data + text);
+        st->out->len = text;
+        put_value(st, assigned->value, strlen(assigned->value), quoted);
+    }
+    else if (*op == '?' && !set)
+    {
+        const char *msg = st->out->data + word_string(st, word, end, 0);
+        errx(1, "%.*s: %s", (int)len, s,
+             *msg ? msg : "parameter null or not set");
+    }
+    else if (value && (*op == '-' || *op == '=' || *op == '?'))
+        put_value(st, value, strlen(value), quoted);
+    free(joined);
+}
+
+// $((expr)): the expression is expanded as a string, then evaluated
+static void put_arithmetic(struct state *st, const char *s, const char *end,
+                           int quoted)
+{
+    size_t expr = word_string(st, s, end, 0);
+    int64_t n = arith(st->out->data + expr, st->var);
+    st->out->len = expr;
+    char buff[32];
+    int len = sprintf(buff, "%" PRId64, n);
+    put_value(st, buff, len, quoted);
+}
+
+/*
+ * Expands the parameter, the command or the arithmetic expression after the
+ * $ at p, and returns what follows it. A $ that starts none stays as it is.
+ */
+static const char *parameter(struct state *st, const char *p, int quoted)
+{
+    if (*p == '{')
+    {
+        const char *end = closing_brace(p + 1);
+        if (!*end)
+            bad_substitution(p + 1, end);
+        enter(st);
+        braced(st, p + 1, end, quoted);
+        st->var->nesting--;
+        return end + 1;
+    }
+    if (p[0] == '(' && p[1] == '(')
+    {
+        const char *end = closing_paren(p + 2, 1);
+        if (!*end)
+            errx(1, "$((%s: missing '))'", p + 2);
+        enter(st);
+        put_arithmetic(st, p + 2, end, quoted);
+        st->var->nesting--;
+        return end + 2;
+    }
+    if (p[0] == '(')
+    {
+        const char *end = closing_paren(p + 1, 0);
+        if (!*end)
+            errx(1, "$(%s: missing ')'", p + 1);
+        enter(st);
+        put_substitution(st, p + 1, end - p - 1, quoted);
+        st->var->nesting--;
+        return end + 1;
+    }
+    size_t len = 0;
+    if (is_name(*p, 1))
+        while (is_name(p[len], 0))
+            len++;
+    else if (*p && strchr("@*?#$!0123456789", *p))
+        len = 1;
+    if (!len)
+    {
+        put(st, "$", 1);
+        return p;
+    }
+    put_parameter(st, p, len, quoted);
+    return p + len;
+}
+
+static void init(struct state *st, struct dico *var, int split)
+{
+    struct key_value *ifs = find_var(var, "IFS");
+    st->var = var;
+    st->out = &var->scratch;
+    st->ifs = ifs && ifs->value ? ifs->value : IFS_DEFAULT;
+    st->split = split;
+    st->pattern = split;
+    st->glob = 0;
+    st->escaped = 0;
+    st->open = 0;
+    st->start = st->out->len;
+    st->after_space = 0;
+    st->drop = 0;
+    st->nb = 0;
+}
+
+static void expand(struct state *st, const char *word)
+{
+    st->drop = 0;
+    st->after_space = 0;
+    st->glob = 0;
+    st->escaped = 0;
+    expand_text(st, word, word + strlen(word), 0);
+    if (st->open && !(st->drop && st->out->len == st->start))
+        end_field(st);
+    st->open = 0;
+}
+
+/*
+ * Copies the fields written since mark into a single block: the array of
+ * pointers, then their text.
+ */
+static char **copy_fields(struct state *st, size_t mark)
+{
+    size_t bytes = st->out->len - mark;
+    char **res = malloc((st->nb + 1) * sizeof(char *) + bytes);
+    if (!res)
+        errx(1, "expand: out of memory");
+    char *text = (char *)(res + st->nb + 1);
+    memcpy(text, st->out->data + mark, bytes);
+    for (int i = 0; i < st->nb; i++)
+    {
+        res[i] = text;
+        text += strlen(text) + 1;
+    }
+    res[st->nb] = NULL;
+    return res;
+}
+
+char **expand_argv(struct ast *ast, int first, struct dico *var, int *nb)
+{
+    *nb = ast->nb_data - first;
+    if (!ast->expand)
+        return ast->data + first;
+    struct state st;
+    init(&st, var, 1);
+    size_t mark = st.out->len;
+    for (int i = first; i < ast->nb_data; i++)
+    {
+        if (word_expands(ast->data[i]))
+            expand(&st, ast->data[i]);
+        else
+        {
+            builder_put(st.out, ast->data[i], strlen(ast->data[i]) + 1);
+            st.start = st.out->len;
+            st.nb++;
+        }
+    }
+    char **res = copy_fields(&st, mark);
+    *nb = st.nb;
+    st.out->len = mark;
+    return res;
+}
+
+void free_argv(struct ast *ast, int first, char **argv)
+{
+    if (argv != ast->data + first)
+        free(argv);
+}
+
+char *expand_word(const char *word, struct dico *var)
+{
+    struct state st;
+    init(&st, var, 0);
+    size_t mark = st.out->len;
+    expand_text(&st, word, word + strlen(word), 0);
+    builder_put(st.out, "", 1);
+    char *res = strdup(st.out->data + mark);
+    st.out->len = mark;
+    return res;
+}
@@ -0,0 +1,67 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <unistd.h>
+
+#include "../ast/ast.h"
+
+/**
+ * \page Expansion
+ *
+ * Words are kept as they are written, quotes included, and are expanded each
+ * time their command runs: parameters are replaced by their value and
+ * commands by their output, what unquoted expansions produced is split into
+ * fields on IFS, and quotes are removed. The fields are written in a
+ * scratch buffer the shell reuses from one command to the next, and are only
+ * copied out once the whole argv is known.
+ */
+
+/*
+ * How deep expansions may nest, as in ${a:-${b:-c}} or $(echo $(echo a)),
+ * counting those of the commands substituted. Each one recurses on the C
+ * stack, so this bounds the stack they use.
+ */
+#ifndef EXPAND_MAX_DEPTH
+#define EXPAND_MAX_DEPTH 1000
+#endif
+
+struct dico;
+
+// A growable byte buffer, emptied but not freed between two uses
+struct builder
+{
+    char *data;
+    size_t len; // Bytes written
+    size_t capacity; // Size of data
+};
+
+/**
+ * \brief Makes room for len more bytes, and returns where they go. They are
+ * only kept once len is increased.
+ */
+char *builder_reserve(struct builder *builder, size_t len);
+
+/**
+ * \brief Appends the len bytes at s.
+ */
+void builder_put(struct builder *builder, const char *s, size_t len);
+
+void builder_free(struct builder *builder);
+
+/**
+ * \brief Expands the words of ast from index first on into the fields they
+ * make, and stores their number in *nb. Returns the words of ast themselves
+ * when none of them expands, otherwise a NULL-terminated array to release
+ * with free_argv.
+ */
+char **expand_argv(struct ast *ast, int first, struct dico *var, int *nb);
+
+void free_argv(struct ast *ast, int first, char **argv);
+
+/**
+ * \brief Expands word into a single string, without splitting it into
+ * fields, as for the value of an assignment. The string is to be freed.
+ */
+char *expand_word(const char *word, struct dico *var);
+
+#endif /* !EXPAND_H */
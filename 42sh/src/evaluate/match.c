@@ -0,0 +1,92 @@
+#include "match.h"
+
+/*
+ * Whether c is in the set at *p, just after its [, and moves *p past the
+ * closing ]. A [ without ] is not a set: it returns -1 and leaves *p alone.
+ */
+static int bracket(const char **p, unsigned char c)
+{
+    const char *q = *p;
+    int negate = *q == '!' || *q == '^';
+    q += negate;
+    int found = 0;
+    for (int first = 1; *q && (first || *q != ']'); first = 0)
+    {
+        if (*q == '\\' && q[1])
+            q++;
+        unsigned char low = *q++;
+        unsigned char high = low;
+        if (*q == '-' && q[1] && q[1] != ']')
+        {
+            q++;
+            if (*q == '\\' && q[1])
+                q++;
+            high = *q++;
+        }
+        found |= low <= c && c <= high;
+    }
+    if (!*q)
+        return -1;
+    *p = q + 1;
+    return found != negate;
+}
+
+// Whether the element of the pattern at *p matches c, and moves *p past it
+static int one(const char **p, char c)
+{
+    const char *q = *p;
+    int res = 0;
+    if (*q == '?')
+        res = 1;
+    else if (*q == '[')
+    {
+        *p = q + 1;
+        int found = bracket(p, c);
+        if (found != -1)
+            return found;
+        res = c == '[';
+    }
+    else
+    {
+        if (*q == '\\' && q[1])
+            q++;
+        res = *q == c;
+    }
+    *p = q + 1;
+    return res;
+}
+
+/*
+ * A * first matches nothing, and takes one more byte each time what follows
+ * it fails. Only the last * needs to be retried: the bytes an earlier one
+ * would take can be taken by the last one as well.
+ */
+int match(const char *pattern, const char *s, size_t len)
+{
+    const char *star = NULL;
+    size_t from = 0;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (*pattern == '*')
+        {
+            star = ++pattern;
+            from = i;
+            continue;
+        }
+        const char *next = pattern;
+        if (*pattern && one(&next, s[i]))
+        {
+            pattern = next;
+            i++;
+            continue;
+        }
+        if (!star)
+            return 0;
+        pattern = star;
+        i = ++from;
+    }
+    while (*pattern == '*')
+        pattern++;
+    return !*pattern;
+}
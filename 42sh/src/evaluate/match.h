@@ -0,0 +1,14 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <unistd.h>
+
+/**
+ * \brief Whether the len bytes at s match the shell pattern: * matches any
+ * bytes, ? any one byte, and [...] one byte of a set, which may hold ranges
+ * and is negated when it starts with ! or ^. A backslash makes the byte after
+ * it literal.
+ */
+int match(const char *pattern, const char *s, size_t len);
+
+#endif /* !MATCH_H */
@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pathname.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "match.h"
+
+// The entries of a directory, as read once
+struct listing
+{
+    struct table_entry entry; // Path of the directory, when kept
+    struct timespec mtime; // Modification time of the directory when read
+    dev_t dev;
+    ino_t ino;
+    struct builder names; // Its entries but . and .., each followed by a NUL
+    size_t nb; // Entries in names
+};
+
+struct walk
+{
+    struct table *listings; // Where directories are kept, NULL if they are not
+    struct builder path; // The directory reached, then an entry of it
+    struct builder found; // Paths matched, each followed by a NUL
+    int nb; // Paths in found
+};
+
+int is_pattern(const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '\\')
+            i++;
+        else if (s[i] == '*' || s[i] == '?')
+            return 1;
+        else if (s[i] == '[' && memchr(s + i + 1, ']', len - i - 1))
+            return 1;
+    }
+    return 0;
+}
+
+static void read_dir(const char *dir, struct listing *listing)
+{
+    DIR *stream = opendir(dir);
+    if (!stream)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(stream)))
+    {
+        const char *name = entry->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+        builder_put(&listing->names, name, strlen(name) + 1);
+        listing->nb++;
+    }
+    closedir(stream);
+}
+
+static void free_listing(struct listing *listing)
+{
+    free(listing->entry.key);
+    builder_free(&listing->names);
+    free(listing);
+}
+
+static int unchanged(const struct listing *listing, const struct stat *st)
+{
+    return listing->dev == st->st_dev && listing->ino == st->st_ino
+        && listing->mtime.tv_sec == st->st_mtim.tv_sec
+        && listing->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Returns the entries of dir, kept in listings if they still are what was
+ * read, or read now. The directory is looked at before it is read, so that
+ * a change while it is read shows on the next look. A listing that is not
+ * kept, *kept says so, is for the caller to free.
+ */
+static struct listing *list_dir(struct table *listings, const char *dir,
+                                int *kept)
+{
+    struct stat st;
+    int known = listings && stat(dir, &st) == 0;
+    struct listing *listing =
+        known ? (struct listing *)table_find(listings, dir) : NULL;
+    *kept = listing && unchanged(listing, &st);
+    if (*kept)
+        return listing;
+    if (listing)
+        free_listing((struct listing *)table_remove(listings, dir));
+    listing = calloc(1, sizeof(struct listing));
+    if (!listing)
+        errx(1, "expand: out of memory");
+    time_t now = time(NULL);
+    read_dir(dir, listing);
+    if (known && st.st_mtim.tv_sec + 1 < now)
+    {
+        listing->entry.key = strdup(dir);
+        listing->mtime = st.st_mtim;
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        table_insert(listings, &listing->entry);
+        *kept = 1;
+    }
+    return listing;
+}
+
+// Whether the path reached names something, as when it ends with literals
+static int exists(struct walk *w)
+{
+    struct stat st;
+    builder_put(&w->path, "", 1);
+    w->path.len--;
+    return lstat(w->path.data, &st) == 0;
+}
+
+static void walk(struct walk *w, const char *pattern);
+
+/*
+ * Goes on after a component with the slashes and the components that follow
+ * it. Only a path whose last component was matched against a directory is
+ * known to exist without looking.
+ */
+static void follow(struct walk *w, const char *rest, int matched)
+{
+    size_t slashes = strspn(rest, "/");
+    builder_put(&w->path, rest, slashes);
+    if (rest[slashes])
+        walk(w, rest + slashes);
+    else if ((matched && !slashes) || exists(w))
+    {
+        builder_put(&w->found, w->path.data, w->path.len);
+        builder_put(&w->found, "", 1);
+        w->nb++;
+    }
+}
+
+// Appends the len bytes of a component without its backslashes
+static void put_literal(struct builder *path, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '\\' && i + 1 < len)
+            i++;
+        builder_put(path, s + i, 1);
+    }
+}
+
+/*
+ * Matches the component at pattern, up to the next slash. A component
+ * without special bytes is appended as it is; the others read the directory
+ * reached, in which names starting with a dot only match a dot.
+ */
+static void walk(struct walk *w, const char *pattern)
+{
+    size_t len = strcspn(pattern, "/");
+    size_t mark = w->path.len;
+    if (!is_pattern(pattern, len))
+    {
+        put_literal(&w->path, pattern, len);
+        follow(w, pattern + len, 0);
+        w->path.len = mark;
+        return;
+    }
+    char *component = strndup(pattern, len);
+    builder_put(&w->path, "", 1);
+    int kept = 0;
+    struct listing *listing =
+        list_dir(w->listings, mark ? w->path.data : ".", &kept);
+    w->path.len = mark;
+    const char *name = listing->names.data;
+    for (size_t i = 0; i < listing->nb; i++, name += strlen(name) + 1)
+    {
+        size_t n = strlen(name);
+        if ((name[0] == '.' && component[0] != '.')
+            || !match(component, name, n))
+            continue;
+        builder_put(&w->path, name, n);
+        follow(w, pattern + len, 1);
+        w->path.len = mark;
+    }
+    if (!kept)
+        free_listing(listing);
+    free(component);
+}
+
+static int compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int expand_pathname(const char *pattern, struct table *listings,
+                    struct builder *out)
+{
+    if (!is_pattern(pattern, strlen(pattern)))
+        return 0;
+    struct walk w = { listings, { NULL, 0, 0 }, { NULL, 0, 0 }, 0 };
+    size_t slashes = strspn(pattern, "/");
+    builder_put(&w.path, pattern, slashes);
+    walk(&w, pattern + slashes);
+    char **paths = malloc(w.nb * sizeof(char *) + 1);
+    if (!paths)
+        errx(1, "expand: out of memory");
+    char *path = w.found.data;
+    for (int i = 0; i < w.nb; i++, path += strlen(path) + 1)
+        paths[i] = path;
+    qsort(paths, w.nb, sizeof(char *), compare);
+    for (int i = 0; i < w.nb; i++)
+        builder_put(out, paths[i], strlen(paths[i]) + 1);
+    free(paths);
+    builder_free(&w.path);
+    builder_free(&w.found);
+    return w.nb;
+}
+
+void free_listings(struct table *listings)
+{
+    size_t pos = 0;
+    struct table_entry *entry;
+    while ((entry = table_next(listings, &pos)))
+        free_listing((struct listing *)entry);
+    table_free(listings);
+}
@@ -0,0 +1,44 @@
+#ifndef PATHNAME_H
+#define PATHNAME_H
+
+#include "expand.h"
+#include "table.h"
+
+/**
+ * \page Pathname
+ *
+ * A field holding an unquoted *, ? or [...] is replaced by the paths it
+ * matches, sorted. Each component of the pattern is matched against the
+ * entries of the directories the components before it led to: a component
+ * without special bytes is appended as it is, and the others read their
+ * directory once.
+ *
+ * When SH42_GLOB_CACHE is set in the environment, the entries read are kept
+ * for the rest of the run, and a directory is only read again once its
+ * modification time changed. A directory modified in the second it was read
+ * may change again without its time showing it, so it is not kept.
+ */
+
+#define GLOB_CACHE_ENV "SH42_GLOB_CACHE"
+
+/**
+ * \brief Whether the len bytes at s hold a *, ? or [...] that no backslash
+ * escapes.
+ */
+int is_pattern(const char *s, size_t len);
+
+/**
+ * \brief Appends the paths pattern matches to out, sorted, each followed by
+ * a NUL, and returns their number. A backslash in pattern makes the byte
+ * after it literal. Directories are read through listings when it is not
+ * NULL, which keeps them.
+ */
+int expand_pathname(const char *pattern, struct table *listings,
+                    struct builder *out);
+
+/**
+ * \brief Frees the directories kept in listings.
+ */
+void free_listings(struct table *listings);
+
+#endif /* !PATHNAME_H */
@@ -0,0 +1,124 @@
+#include "table.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MIN 16
+
+// Marks a slot whose entry was removed, so that probing goes on past it
+static struct table_entry removed;
+
+static uint64_t hash(const char *key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *key; key++)
+        h = (h ^ (unsigned char)*key) * 0x100000001b3ULL;
+    return h;
+}
+
+/*
+ * Returns the slot holding key, or the NULL slot that ends its probe
+ * sequence. The table always keeps a NULL slot, so this terminates.
+ */
+static size_t probe(const struct table *table, const char *key, uint64_t h)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = h & mask;
+    while (table->slots[i])
+    {
+        struct table_entry *entry = table->slots[i];
+        if (entry != &removed && entry->hash == h && !strcmp(entry->key, key))
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/*
+ * Rehashes into a table of capacity slots, which drops the removed marks.
+ */
+static void resize(struct table *table, size_t capacity)
+{
+    struct table_entry **slots = table->slots;
+    size_t old = table->capacity;
+    table->slots = calloc(capacity, sizeof(struct table_entry *));
+    if (!table->slots)
+        errx(1, "table: out of memory");
+    table->capacity = capacity;
+    table->used = table->size;
+    for (size_t i = 0; i < old; i++)
+    {
+        if (!slots[i] || slots[i] == &removed)
+            continue;
+        size_t j = slots[i]->hash & (capacity - 1);
+        while (table->slots[j])
+            j = (j + 1) & (capacity - 1);
+        table->slots[j] = slots[i];
+    }
+    free(slots);
+}
+
+struct table_entry *table_find(const struct table *table, const char *key)
+{
+    if (!table->size)
+        return NULL;
+    return table->slots[probe(table, key, hash(key))];
+}
+
+void table_insert(struct table *table, struct table_entry *entry)
+{
+    // Keeps at most three quarters of the slots used
+    if (4 * (table->used + 1) > 3 * table->capacity)
+    {
+        size_t capacity = table->capacity ? table->capacity : TABLE_MIN;
+        while (4 * (table->size + 1) > 3 * capacity / 2)
+            capacity *= 2;
+        resize(table, capacity);
+    }
+    entry->hash = hash(entry->key);
+    size_t mask = table->capacity - 1;
+    size_t i = entry->hash & mask;
+    while (table->slots[i] && table->slots[i] != &removed)
+        i = (i + 1) & mask;
+    if (!table->slots[i])
+        table->used++;
+    table->slots[i] = entry;
+    table->size++;
+}
+
+struct table_entry *table_remove(struct table *table, const char *key)
+{
+    if (!table->size)
+        return NULL;
+    size_t i = probe(table, key, hash(key));
+    struct table_entry *entry = table->slots[i];
+    if (!entry)
+        return NULL;
+    table->slots[i] = &removed;
+    table->size--;
+    return entry;
+}
+
+struct table_entry *table_next(const struct table *table, size_t *pos)
+{
+    for (; *pos < table->capacity; (*pos)++)
+    {
+        struct table_entry *entry = table->slots[*pos];
+        if (entry && entry != &removed)
+        {
+            (*pos)++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void table_free(struct table *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->size = 0;
+    table->used = 0;
+}
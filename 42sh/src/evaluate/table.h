@@ -0,0 +1,57 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * \page Table
+ *
+ * A hash table of named entries with open addressing and linear probing.
+ * The table only holds pointers: an entry embeds a struct table_entry as its
+ * first member and stays where it was allocated, so a pointer to it remains
+ * valid while the table grows, until the entry is removed.
+ */
+
+struct table_entry
+{
+    char *key; // Name of the entry, owned by the entry
+    uint64_t hash; // Hash of key, kept to grow without hashing again
+};
+
+struct table
+{
+    struct table_entry **slots; // NULL, a removed mark, or an entry
+    size_t capacity; // Number of slots, a power of two or 0
+    size_t size; // Entries in the table
+    size_t used; // Slots that are not NULL, removed marks included
+};
+
+/**
+ * \brief Returns the entry named key, or NULL.
+ */
+struct table_entry *table_find(const struct table *table, const char *key);
+
+/**
+ * \brief Adds entry, whose key must not be in the table yet.
+ */
+void table_insert(struct table *table, struct table_entry *entry);
+
+/**
+ * \brief Takes the entry named key out of the table and returns it, or NULL.
+ */
+struct table_entry *table_remove(struct table *table, const char *key);
+
+/**
+ * \brief Returns the entry after the slot *pos and moves *pos past it, or
+ * NULL at the end. *pos starts at 0. Removing the entry returned is allowed
+ * while iterating, inserting is not.
+ */
+struct table_entry *table_next(const struct table *table, size_t *pos);
+
+/**
+ * \brief Frees the slots. The entries belong to the caller.
+ */
+void table_free(struct table *table);
+
+#endif /* !TABLE_H */
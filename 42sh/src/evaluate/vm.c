@@ -0,0 +1,320 @@
+#include "vm.h"
+
+#include <err.h>
+#include <stdlib.h>
+
+static int emit(struct program *program, enum opcode op, int a,
+                struct ast *node)
+{
+    if (program->size == program->capacity)
+    {
+        program->capacity = program->capacity ? 2 * program->capacity : 16;
+        program->code = realloc(program->code,
+                                program->capacity * sizeof(struct instr));
+        if (!program->code)
+            errx(1, "vm: out of memory");
+    }
+    struct instr *instr = program->code + program->size;
+    instr->op = op;
+    instr->builtin = BUILTIN_UNKNOWN;
+    instr->a = a;
+    instr->b = 0;
+    instr->node = node;
+    return program->size++;
+}
+
+// Points the jump emitted at from to the next instruction
+static void patch(struct program *program, int from)
+{
+    program->code[from].a = program->size;
+}
+
+static void compile(struct program *program, struct ast *ast);
+
+/*
+ * A list stops at the first command that leaves a break or a continue
+ * pending, and sets $? once it is done, as its enclosing nodes see it.
+ */
+static void compile_list(struct program *program, struct ast *ast)
+{
+    int *exits = calloc(ast->nb_ast + 1, sizeof(int));
+    for (int i = 0; i < ast->nb_ast; i++)
+    {
+        compile(program, ast->ast_list[i]);
+        exits[i] = emit(program, OP_UNWIND, 0, NULL);
+    }
+    for (int i = 0; i < ast->nb_ast; i++)
+        patch(program, exits[i]);
+    free(exits);
+    emit(program, OP_STATUS, 0, NULL);
+}
+
+// An if without else whose condition fails has status 0
+static void compile_if(struct program *program, struct ast *ast)
+{
+    compile(program, ast->ast_list[0]);
+    int otherwise = emit(program, OP_JUMP_NONZERO, 0, NULL);
+    compile(program, ast->ast_list[1]);
+    int end = emit(program, OP_JUMP, 0, NULL);
+    patch(program, otherwise);
+    if (ast->nb_ast == 3)
+        compile(program, ast->ast_list[2]);
+    else
+        emit(program, OP_SET, 0, NULL);
+    patch(program, end);
+    emit(program, OP_STATUS, 0, NULL);
+}
+
+/*
+ * a && b && c stops at the first failure with status 1, and otherwise has
+ * the status of its last command as 0 or 1, as eval_and computes it.
+ */
+static void compile_and(struct program *program, struct ast *ast)
+{
+    compile(program, ast->ast_list[0]);
+    int *fails = calloc(ast->nb_ast, sizeof(int));
+    for (int i = 1; i < ast->nb_ast; i++)
+    {
+        fails[i] = emit(program, OP_JUMP_NONZERO, 0, NULL);
+        compile(program, ast->ast_list[i]);
+        emit(program, OP_BOOL, 0, NULL);
+    }
+    if (ast->nb_ast > 1)
+    {
+        int end = emit(program, OP_JUMP, 0, NULL);
+        for (int i = 1; i < ast->nb_ast; i++)
+            patch(program, fails[i]);
+        emit(program, OP_SET, 1, NULL);
+        patch(program, end);
+    }
+    free(fails);
+    emit(program, OP_STATUS, 0, NULL);
+}
+
+// a || b || c stops at the first success, which leaves res at 0
+static void compile_or(struct program *program, struct ast *ast)
+{
+    compile(program, ast->ast_list[0]);
+    int *done = calloc(ast->nb_ast, sizeof(int));
+    for (int i = 1; i < ast->nb_ast; i++)
+    {
+        done[i] = emit(program, OP_JUMP_ZERO, 0, NULL);
+        compile(program, ast->ast_list[i]);
+        emit(program, OP_BOOL, 0, NULL);
+    }
+    for (int i = 1; i < ast->nb_ast; i++)
+        patch(program, done[i]);
+    free(done);
+    emit(program, OP_STATUS, 0, NULL);
+}
+
+/*
+ * The status of a loop is the one of its last body, kept in a slot of its
+ * own while the condition overwrites res.
+ */
+static void compile_while(struct program *program, struct ast *ast)
+{
+    int slot = program->nb_slots++;
+    emit(program, OP_SET, 0, NULL);
+    emit(program, OP_SAVE, slot, NULL);
+    int top = program->size;
+    compile(program, ast->ast_list[0]);
+    int exit = emit(program,
+                    ast->type == AST_WHILE ? OP_JUMP_NONZERO : OP_JUMP_ZERO,
+                    0, NULL);
+    compile(program, ast->ast_list[1]);
+    emit(program, OP_SAVE, slot, NULL);
+    int brk = emit(program, OP_LOOP, 0, NULL);
+    emit(program, OP_JUMP, top, NULL);
+    patch(program, exit);
+    patch(program, brk);
+    emit(program, OP_LOAD, slot, NULL);
+    if (ast->type == AST_WHILE)
+        emit(program, OP_STATUS, 0, NULL);
+}
+
+// The words of a for are expanded once, when the loop starts
+static void compile_for(struct program *program, struct ast *ast)
+{
+    int slot = program->nb_slots++;
+    int list = program->nb_lists++;
+    emit(program, OP_SET, 0, NULL);
+    emit(program, OP_SAVE, slot, NULL);
+    emit(program, OP_EXPAND, list, ast);
+    int top = emit(program, OP_FOR, 0, ast);
+    program->code[top].b = list;
+    compile(program, ast->ast_list[0]);
+    emit(program, OP_SAVE, slot, NULL);
+    int brk = emit(program, OP_LOOP, 0, NULL);
+    emit(program, OP_JUMP, top, NULL);
+    patch(program, top);
+    patch(program, brk);
+    emit(program, OP_LOAD, slot, NULL);
+}
+
+static void compile_command(struct program *program, struct ast *ast)
+{
+    int run = emit(program, OP_RUN, 0, ast);
+    if (ast->nb_data && !word_expands(ast->data[0]))
+        program->code[run].builtin = builtin_of(ast->data[0]);
+    emit(program, OP_STATUS, 0, NULL);
+}
+
+static void compile(struct program *program, struct ast *ast)
+{
+    switch (ast->type)
+    {
+    case AST_COMMAND:
+        compile_command(program, ast);
+        break;
+    case AST_LIST:
+        compile_list(program, ast);
+        break;
+    case AST_IF:
+        compile_if(program, ast);
+        break;
+    case AST_AND:
+        compile_and(program, ast);
+        break;
+    case AST_OR:
+        compile_or(program, ast);
+        break;
+    case AST_WHILE:
+    case AST_UNTIL:
+        compile_while(program, ast);
+        break;
+    case AST_FOR:
+        compile_for(program, ast);
+        break;
+    case AST_NEG:
+        compile(program, ast->ast_list[0]);
+        emit(program, OP_NOT, 0, NULL);
+        break;
+    case AST_COMMAND_BLOCK:
+        compile(program, ast->ast_list[0]);
+        break;
+    default:
+        emit(program, OP_EVAL, 0, ast);
+        break;
+    }
+}
+
+struct program *vm_compile(struct ast *ast)
+{
+    struct program *program = calloc(1, sizeof(struct program));
+    if (!program)
+        errx(1, "vm: out of memory");
+    if (ast)
+        compile(program, ast);
+    emit(program, OP_HALT, 0, NULL);
+    return program;
+}
+
+// The words a for loop goes through, and the next one
+struct list
+{
+    char **words;
+    int nb;
+    int next;
+    struct ast *node; // The for node, whose words are released with free_argv
+};
+
+static void free_lists(struct list *lists, int nb)
+{
+    for (int i = 0; i < nb; i++)
+        if (lists[i].node)
+            free_argv(lists[i].node, 1, lists[i].words);
+    free(lists);
+}
+
+int vm_run(struct program *program, struct dico *var)
+{
+    int *slots = calloc(program->nb_slots + 1, sizeof(int));
+    struct list *lists = calloc(program->nb_lists + 1, sizeof(struct list));
+    int res = 0;
+    const struct instr *code = program->code;
+    for (int pc = 0;; pc++)
+    {
+        const struct instr *instr = code + pc;
+        switch (instr->op)
+        {
+        case OP_RUN:
+            res = evaluate_command(instr->node, instr->builtin, var);
+            break;
+        case OP_EVAL:
+            res = ast_evaluate(instr->node, var);
+            break;
+        case OP_STATUS:
+            set_status(var, res);
+            break;
+        case OP_SET:
+            res = instr->a;
+            break;
+        case OP_NOT:
+            res = !res;
+            break;
+        case OP_BOOL:
+            res = res != 0;
+            break;
+        case OP_JUMP:
+            pc = instr->a - 1;
+            break;
+        case OP_JUMP_ZERO:
+            if (!res)
+                pc = instr->a - 1;
+            break;
+        case OP_JUMP_NONZERO:
+            if (res)
+                pc = instr->a - 1;
+            break;
+        case OP_UNWIND:
+            if (var->breakf > 0 || var->continuef > 0)
+                pc = instr->a - 1;
+            break;
+        case OP_SAVE:
+            slots[instr->a] = res;
+            break;
+        case OP_LOAD:
+            res = slots[instr->a];
+            break;
+        case OP_EXPAND: {
+            struct list *list = lists + instr->a;
+            if (list->node)
+                free_argv(list->node, 1, list->words);
+            list->node = instr->node;
+            list->words = expand_argv(instr->node, 1, var, &list->nb);
+            list->next = 0;
+            break;
+        }
+        case OP_FOR: {
+            struct list *list = lists + instr->b;
+            if (list->next >= list->nb)
+                pc = instr->a - 1;
+            else
+                set_var(var, instr->node->data[0], list->words[list->next++]);
+            break;
+        }
+        case OP_LOOP:
+            if (var->continuef)
+                var->continuef = 0;
+            else if (var->breakf)
+            {
+                var->breakf = 0;
+                pc = instr->a - 1;
+            }
+            break;
+        case OP_HALT:
+            free(slots);
+            free_lists(lists, program->nb_lists);
+            return res;
+        }
+    }
+}
+
+void vm_free(struct program *program)
+{
+    if (!program)
+        return;
+    free(program->code);
+    free(program);
+}
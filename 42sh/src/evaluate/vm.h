@@ -0,0 +1,75 @@
+#ifndef VM_H
+#define VM_H
+
+#include "../ast/ast.h"
+#include "evaluate.h"
+
+/**
+ * \page VM
+ *
+ * Commands can be compiled to a flat program and run by a loop that jumps
+ * between instructions, instead of walking the tree and dispatching on the
+ * type of every node each time a loop comes back to it. Control flow (lists,
+ * if, &&, ||, !, while, until, for and blocks) becomes jumps, simple commands
+ * have their builtin resolved once, and the remaining nodes (pipes,
+ * redirections, subshells, function definitions) are handed to ast_evaluate.
+ *
+ * The VM is used when SH42_VM is set in the environment, so that both paths
+ * can be compared on the same scripts. It must behave exactly as the tree
+ * walker does, down to when $? is updated and how break and continue unwind.
+ */
+
+#define VM_ENV "SH42_VM"
+
+enum opcode
+{
+    OP_RUN, // Runs the simple command node with builtin, sets res
+    OP_EVAL, // Runs node with ast_evaluate, sets res
+    OP_STATUS, // Stores res in $?
+    OP_SET, // res = a
+    OP_NOT, // res = !res
+    OP_BOOL, // res = res != 0
+    OP_JUMP, // Goes to a
+    OP_JUMP_ZERO, // Goes to a if res is 0
+    OP_JUMP_NONZERO, // Goes to a if res is not 0
+    OP_UNWIND, // Goes to a if a break or a continue is pending
+    OP_SAVE, // slots[a] = res
+    OP_LOAD, // res = slots[a]
+    OP_EXPAND, // Expands the words of the for node into lists[a]
+    OP_FOR, // Assigns the next word of lists[b] to node, else goes to a
+    OP_LOOP, // Ends a loop body: clears continue, goes to a on break
+    OP_HALT, // Ends the program
+};
+
+struct instr
+{
+    enum opcode op;
+    enum builtin builtin; // Builtin of the command run by OP_RUN
+    int a; // Target, value or slot depending on op
+    int b; // List of OP_FOR
+    struct ast *node; // Node of OP_RUN, OP_EVAL and OP_FOR
+};
+
+struct program
+{
+    struct instr *code; // The instructions, ending with OP_HALT
+    int size; // Instructions in code
+    int capacity; // Room allocated for code
+    int nb_slots; // Integers the program needs while it runs
+    int nb_lists; // Expanded word lists of the for loops
+};
+
+/**
+ ** \brief Compiles the tree into a program. The program points into the tree
+ ** and must not outlive it.
+ */
+struct program *vm_compile(struct ast *ast);
+
+/**
+ ** \brief Runs the program and returns the status of its last command.
+ */
+int vm_run(struct program *program, struct dico *var);
+
+void vm_free(struct program *program);
+
+#endif /* !VM_H */
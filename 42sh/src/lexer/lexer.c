@@ -1,11 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "lexer.h"
 
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scan.h"
 
-struct lexer *lexer_new(const char *input)
+static void init_sets(void);
+
+struct lexer *lexer_new(const char *input, size_t len)
 {
     if (!input)
         return NULL;
@@ -13,108 +25,431 @@ struct lexer *lexer_new(const char *input)
     if (!lexer)
         return NULL;
     lexer->input = input;
+    lexer->len = len;
+    lexer->fd = -1;
+    lexer->owned_fd = -1;
+    init_sets();
+    return lexer;
+}
+
+struct lexer *lexer_new_fd(int fd)
+{
+    struct lexer *lexer = lexer_new("", 0);
+    if (lexer)
+        lexer->fd = fd;
+    return lexer;
+}
+
+struct lexer *lexer_new_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        struct lexer *lexer = lexer_new_fd(fd);
+        if (lexer)
+            lexer->owned_fd = fd;
+        else
+            close(fd);
+        return lexer;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+    struct lexer *lexer = lexer_new(map, st.st_size);
+    if (lexer)
+        lexer->mapped = 1;
+    else
+        munmap(map, st.st_size);
     return lexer;
 }
 
 void lexer_free(struct lexer *lexer)
 {
+    for (int i = 0; i < LEXER_LOOKAHEAD; i++)
+        if (lexer->ahead[i].valid)
+            token_free(lexer->ahead[i].token);
+    if (lexer->mapped)
+        munmap((void *)lexer->input, lexer->len);
+    if (lexer->owned_fd != -1)
+        close(lexer->owned_fd);
+    free(lexer->buffer);
     free(lexer);
 }
 
-static int cond(struct lexer *lexer, int i)
+/*
+ * Drops the input before pos: offsets inside the buffer move back, and
+ * remembered tokens that started before it are forgotten.
+ */
+void lexer_discard(struct lexer *lexer)
 {
-    if (i && lexer->input[lexer->pos] != ' ' && lexer->input[lexer->pos] != '\n'
-        && lexer->input[lexer->pos] != ';' && lexer->input[lexer->pos] != '>'
-        && lexer->input[lexer->pos] != '<' && lexer->input[lexer->pos] != ')'
-        && lexer->input[lexer->pos] != '(')
-        return 1;
-    if (lexer->input[lexer->pos] != ' ' && lexer->input[lexer->pos] != '\n'
-        && lexer->input[lexer->pos] != ';' && lexer->input[lexer->pos] != '>'
-        && lexer->input[lexer->pos] != '<' && lexer->input[lexer->pos] != ')'
-        && lexer->input[lexer->pos] != '(' && lexer->input[lexer->pos] != '{'
-        && lexer->input[lexer->pos] != '}')
-        return 1;
-    return 0;
+    size_t drop = lexer->pos;
+    if (!lexer->buffer || drop < lexer->capacity / 2)
+        return;
+    memmove(lexer->buffer, lexer->buffer + drop, lexer->len - drop);
+    lexer->len -= drop;
+    lexer->pos = 0;
+    lexer->base += drop;
+    for (int i = 0; i < LEXER_LOOKAHEAD; i++)
+    {
+        struct lookahead *slot = &lexer->ahead[i];
+        if (!slot->valid)
+            continue;
+        if (slot->start < drop)
+        {
+            token_free(slot->token);
+            slot->valid = 0;
+            continue;
+        }
+        slot->start -= drop;
+        slot->end -= drop;
+        slot->token.offset -= drop;
+    }
 }
 
-static char *to_str(struct lexer *lexer, size_t len)
+/*
+ * Reads more of the stream at the end of the buffer, growing it when it is
+ * full. Returns 0 once the stream is over.
+ */
+static int refill(struct lexer *lexer)
 {
-    char *res = calloc(len + 1, sizeof(char));
-    size_t size = 0;
-    if (lexer->input[lexer->pos] == '\'')
+    if (lexer->fd < 0)
+        return 0;
+    if (lexer->len == lexer->capacity)
     {
-        lexer->pos++;
-        while (lexer->pos < len && lexer->input[lexer->pos] != '\'')
-            res[size++] = lexer->input[lexer->pos++];
-        if (lexer->pos == len && lexer->input[lexer->pos - 1] != '\'')
-            errx(2, "Error while lexing quotes");
-        lexer->pos++;
+        size_t capacity = lexer->capacity ? 2 * lexer->capacity : LEXER_CHUNK;
+        char *buffer = realloc(lexer->buffer, capacity);
+        if (!buffer)
+            errx(1, "Could not grow the input buffer");
+        lexer->buffer = buffer;
+        lexer->capacity = capacity;
+        lexer->input = buffer;
     }
-    else if (lexer->input[lexer->pos] == '"')
+    ssize_t size = 0;
+    do
+        size = read(lexer->fd, lexer->buffer + lexer->len,
+                    lexer->capacity - lexer->len);
+    while (size < 0 && errno == EINTR);
+    if (size <= 0)
     {
-        lexer->pos++;
-        while (lexer->pos < len && lexer->input[lexer->pos] != '"')
-        {
-            if (lexer->input[lexer->pos] == '\\')
-                lexer->pos++;
-            res[size++] = lexer->input[lexer->pos++];
-        }
-        if (lexer->pos == len && lexer->input[lexer->pos - 1] != '"')
-            errx(2, "Error while lexing quotes");
-        lexer->pos++;
+        lexer->fd = -1;
+        return 0;
     }
-    else if (lexer->input[lexer->pos] == '$')
+    lexer->len += size;
+    return 1;
+}
+
+/*
+ * Character classes, so that deciding which kind of token starts is a single
+ * lookup instead of a chain of comparisons.
+ */
+enum char_class
+{
+    CC_SYMBOL = 1 << 0, // one character token: ';', '\n', '!', '{', '}', ...
+    CC_REDIR = 1 << 1, // starts a redirection: '<', '>'
+};
+
+static const unsigned char char_class[256] = {
+    ['\n'] = CC_SYMBOL, [';'] = CC_SYMBOL, ['('] = CC_SYMBOL,
+    [')'] = CC_SYMBOL,  ['{'] = CC_SYMBOL, ['}'] = CC_SYMBOL,
+    ['!'] = CC_SYMBOL,  ['<'] = CC_REDIR,  ['>'] = CC_REDIR,
+};
+
+static int is_class(char c, int class)
+{
+    return char_class[(unsigned char)c] & class;
+}
+
+// Bytes that end a word unless quoted or escaped, then the ones it stops at
+#define WORD_STOP " \n;<>(){}"
+#define WORD_QUOTING "\\'\"$`"
+#define WORD_SCAN WORD_STOP WORD_QUOTING
+
+static struct scan_set word_scan;
+static struct scan_set single_quote;
+static struct scan_set double_quote;
+static struct scan_set in_braces;
+static struct scan_set in_parens;
+static struct scan_set backquote;
+static struct scan_set newline;
+// Parameters open around the byte being skipped
+static int nesting = 0;
+
+static void init_sets(void)
+{
+    static int done = 0;
+    if (done)
+        return;
+    scan_set_init(&word_scan, WORD_SCAN);
+    scan_set_init(&single_quote, "'");
+    scan_set_init(&double_quote, "\"\\$`");
+    scan_set_init(&in_braces, "}'\"\\$`");
+    scan_set_init(&in_parens, "()'\"\\$`");
+    scan_set_init(&backquote, "`\\");
+    scan_set_init(&newline, "\n");
+    done = 1;
+}
+
+static size_t until(struct lexer *lexer, const struct scan_set *set)
+{
+    return scan_until(lexer->input + lexer->pos, lexer->len - lexer->pos, set);
+}
+
+// Moves past a backslash and the byte it escapes
+static void skip_escape(struct lexer *lexer)
+{
+    lexer->pos += lexer->pos + 1 < lexer->len ? 2 : 1;
+}
+
+// Moves past the backquoted command at pos, in which \\ escapes a backquote
+static void skip_backquoted(struct lexer *lexer)
+{
+    lexer->pos++;
+    while (lexer->pos < lexer->len)
     {
-        while (lexer->pos < len && cond(lexer, 1))
-            res[size++] = lexer->input[lexer->pos++];
+        lexer->pos += until(lexer, &backquote);
+        if (lexer->pos == lexer->len || lexer->input[lexer->pos] == '`')
+            break;
+        skip_escape(lexer);
     }
-    while (lexer->pos < len && cond(lexer, 0))
+    if (lexer->pos < lexer->len)
+        lexer->pos++;
+    else if (lexer->fd < 0)
+        errx(2, "Error while lexing backquotes");
+}
+
+static void skip_parameter(struct lexer *lexer);
+
+/*
+ * Moves past the quoted text that starts at pos, closing quote included. In
+ * double quotes, a backslash escapes the byte after it and parameters may
+ * hold quotes of their own.
+ */
+static void skip_quoted(struct lexer *lexer)
+{
+    char quote = lexer->input[lexer->pos++];
+    if (quote == '\'')
+        lexer->pos += until(lexer, &single_quote);
+    while (quote == '"' && lexer->pos < lexer->len)
     {
+        lexer->pos += until(lexer, &double_quote);
+        if (lexer->pos == lexer->len || lexer->input[lexer->pos] == '"')
+            break;
         if (lexer->input[lexer->pos] == '\\')
-            lexer->pos++;
-        res[size++] = lexer->input[lexer->pos++];
+            skip_escape(lexer);
+        else if (lexer->input[lexer->pos] == '`')
+            skip_backquoted(lexer);
+        else
+            skip_parameter(lexer);
     }
-    return res;
+    if (lexer->pos < lexer->len)
+        lexer->pos++;
+    else if (lexer->fd < 0)
+        errx(2, "Error while lexing quotes");
 }
 
-static void skip(struct lexer *lexer, size_t len, char c)
+// Moves past the quotes, the backslash, the backquote or the $ at pos
+static void skip_special(struct lexer *lexer)
 {
-    if (c == '\n')
+    char c = lexer->input[lexer->pos];
+    if (c == '\'' || c == '"')
+        skip_quoted(lexer);
+    else if (c == '\\')
+        skip_escape(lexer);
+    else if (c == '`')
+        skip_backquoted(lexer);
+    else
+        skip_parameter(lexer);
+}
+
+/*
+ * Moves past the command after $(, or the arithmetic expression after $((,
+ * and the ) or )) that closes it. Parentheses may nest in them.
+ */
+static void skip_parens(struct lexer *lexer, int arithmetic)
+{
+    int depth = 0;
+    while (lexer->pos < lexer->len)
     {
-        while (lexer->pos < len && lexer->input[lexer->pos] != c)
+        lexer->pos += until(lexer, &in_parens);
+        if (lexer->pos == lexer->len)
+            break;
+        const char *p = lexer->input + lexer->pos;
+        if (*p == ')' && !depth && !arithmetic)
+        {
+            lexer->pos++;
+            return;
+        }
+        if (*p == ')' && !depth && lexer->pos + 1 < lexer->len && p[1] == ')')
+        {
+            lexer->pos += 2;
+            return;
+        }
+        if (*p == '(' || *p == ')')
+        {
+            if (*p == '(')
+                depth++;
+            else if (depth)
+                depth--;
             lexer->pos++;
+        }
+        else
+            skip_special(lexer);
     }
-    else
+}
+
+/*
+ * Moves past a $, and past the braces, the command or the arithmetic
+ * expression that may follow it. The word of an operator inside braces may
+ * hold quotes and other parameters.
+ */
+static void skip_dollar(struct lexer *lexer)
+{
+    lexer->pos++;
+    const char *p = lexer->input + lexer->pos;
+    if (lexer->pos < lexer->len && *p == '(')
     {
-        while (lexer->pos < len && lexer->input[lexer->pos] == c)
+        int arithmetic = lexer->pos + 1 < lexer->len && p[1] == '(';
+        lexer->pos += 1 + arithmetic;
+        skip_parens(lexer, arithmetic);
+        return;
+    }
+    if (lexer->pos == lexer->len || *p != '{')
+        return;
+    lexer->pos++;
+    while (lexer->pos < lexer->len)
+    {
+        lexer->pos += until(lexer, &in_braces);
+        if (lexer->pos == lexer->len)
+            break;
+        if (lexer->input[lexer->pos] == '}')
+        {
             lexer->pos++;
+            return;
+        }
+        skip_special(lexer);
     }
 }
 
-static enum token_type word_care(char *str)
-{
-    if (!strcmp(str, "if"))
-        return TOKEN_IF;
-    if (!strcmp(str, "then"))
-        return TOKEN_THEN;
-    if (!strcmp(str, "elif"))
-        return TOKEN_ELIF;
-    if (!strcmp(str, "else"))
-        return TOKEN_ELSE;
-    if (!strcmp(str, "fi"))
-        return TOKEN_FI;
-    if (!strcmp(str, "while"))
-        return TOKEN_WHILE;
-    if (!strcmp(str, "do"))
-        return TOKEN_DO;
-    if (!strcmp(str, "done"))
-        return TOKEN_DONE;
-    if (!strcmp(str, "until"))
-        return TOKEN_UNTIL;
-    if (!strcmp(str, "for"))
-        return TOKEN_FOR;
-    if (!strcmp(str, "in"))
-        return TOKEN_IN;
+/*
+ * Moves past the parameter at pos one nesting level deeper. Past
+ * LEXER_MAX_DEPTH levels lexing stops, instead of letting the C stack
+ * overflow.
+ */
+static void skip_parameter(struct lexer *lexer)
+{
+    if (nesting >= LEXER_MAX_DEPTH)
+        errx(2, "Error while lexing: nested deeper than %d levels",
+             LEXER_MAX_DEPTH);
+    nesting++;
+    skip_dollar(lexer);
+    nesting--;
+}
+
+/*
+ * Moves past the word at pos. Its text is kept as written, quotes and
+ * backslashes included, and is expanded when the command runs: quoted and
+ * escaped bytes only matter here to find where the word ends.
+ */
+static void to_str(struct lexer *lexer, struct token *token)
+{
+    token->offset = lexer->pos;
+    while (lexer->pos < lexer->len)
+    {
+        lexer->pos += until(lexer, &word_scan);
+        if (lexer->pos == lexer->len)
+            break;
+        if (!strchr(WORD_QUOTING, lexer->input[lexer->pos]))
+            break;
+        skip_special(lexer);
+    }
+    token->len = lexer->pos - token->offset;
+}
+
+static void skip(struct lexer *lexer, char c)
+{
+    if (c == '\n')
+        lexer->pos += until(lexer, &newline);
+    else
+        lexer->pos += scan_while(lexer->input + lexer->pos,
+                                 lexer->len - lexer->pos, c);
+}
+
+/*
+ * Reserved words are told apart by their length and one distinguishing
+ * character, so a word costs at most one memcmp.
+ */
+static enum token_type word_care(const char *str, size_t len)
+{
+    const char *word = NULL;
+    enum token_type type = TOKEN_WORD;
+    switch (len)
+    {
+    case 2:
+        switch (str[1])
+        {
+        case 'f':
+            word = "if";
+            type = TOKEN_IF;
+            break;
+        case 'n':
+            word = "in";
+            type = TOKEN_IN;
+            break;
+        case 'i':
+            word = "fi";
+            type = TOKEN_FI;
+            break;
+        case 'o':
+            word = "do";
+            type = TOKEN_DO;
+            break;
+        }
+        break;
+    case 3:
+        word = "for";
+        type = TOKEN_FOR;
+        break;
+    case 4:
+        switch (str[2])
+        {
+        case 'e':
+            word = "then";
+            type = TOKEN_THEN;
+            break;
+        case 'i':
+            word = "elif";
+            type = TOKEN_ELIF;
+            break;
+        case 's':
+            word = "else";
+            type = TOKEN_ELSE;
+            break;
+        case 'n':
+            word = "done";
+            type = TOKEN_DONE;
+            break;
+        }
+        break;
+    case 5:
+        if (str[0] == 'w')
+        {
+            word = "while";
+            type = TOKEN_WHILE;
+        }
+        else
+        {
+            word = "until";
+            type = TOKEN_UNTIL;
+        }
+        break;
+    }
+    if (word && !memcmp(str, word, len))
+        return type;
     return TOKEN_WORD;
 }
 
@@ -135,33 +470,19 @@ static enum token_type symbol_care(char c)
     return TOKEN_BACKSLASH;
 }
 
-static char *redir_care(struct lexer *lexer, size_t len)
+static size_t redir_care(struct lexer *lexer)
 {
-    char *l = calloc(3, sizeof(char));
-    l[0] = lexer->input[lexer->pos++];
-    if (lexer->pos >= len)
-        return l;
-    if (!strcmp(l, ">"))
+    char c = lexer->input[lexer->pos++];
+    if (lexer->pos >= lexer->len)
+        return 1;
+    char next = lexer->input[lexer->pos];
+    if ((c == '>' && (next == '>' || next == '&' || next == '|'))
+        || (c == '<' && (next == '&' || next == '>')))
     {
-        l[1] = lexer->input[lexer->pos++];
-        if (!strcmp(l, ">>"))
-            return l;
-        if (!strcmp(l, ">&"))
-            return l;
-        if (!strcmp(l, ">|"))
-            return l;
-        lexer->pos--;
-        l[1] = 0;
-        return l;
+        lexer->pos++;
+        return 2;
     }
-    l[1] = lexer->input[lexer->pos++];
-    if (!strcmp(l, "<&"))
-        return l;
-    if (!strcmp(l, "<>"))
-        return l;
-    lexer->pos--;
-    l[1] = 0;
-    return l;
+    return 1;
 }
 
 static int to_pipe(struct lexer *lexer, struct token *token)
@@ -169,7 +490,7 @@ static int to_pipe(struct lexer *lexer, struct token *token)
     if (lexer->input[lexer->pos] == '|')
     {
         lexer->pos++;
-        if (lexer->input[lexer->pos] == '|')
+        if (lexer->pos < lexer->len && lexer->input[lexer->pos] == '|')
         {
             lexer->pos++;
             token->type = TOKEN_OR;
@@ -186,7 +507,7 @@ static int to_esp(struct lexer *lexer, struct token *token)
     if (lexer->input[lexer->pos] == '&')
     {
         lexer->pos++;
-        if (lexer->input[lexer->pos] == '&')
+        if (lexer->pos < lexer->len && lexer->input[lexer->pos] == '&')
         {
             lexer->pos++;
             token->type = TOKEN_AND;
@@ -198,84 +519,136 @@ static int to_esp(struct lexer *lexer, struct token *token)
     return 0;
 }
 
-struct token assignment_care(struct token token)
+// An assignment is a name, made of letters, digits and _, followed by =
+struct token assignment_care(struct token token, const char *text)
 {
-    if (token.data[0] != '=' && (token.data[0] < '0' || token.data[0] > '9'))
+    size_t i = 0;
+    while (i < token.len
+           && (isalnum((unsigned char)text[i]) || text[i] == '_'))
+        i++;
+    if (i && i < token.len && text[i] == '='
+        && !isdigit((unsigned char)text[0]))
         token.type = TOKEN_ASSIGNMENT_WORD;
     else
-        token.type = word_care(token.data);
+        token.type = word_care(text, token.len);
     return token;
 }
 
-struct token parse_input_for_tok(struct lexer *lexer)
+/*
+ * Lexes one token from what is in the buffer. grows tells whether the token
+ * could have been longer had the buffer held more input.
+ */
+static struct token lex_token(struct lexer *lexer, int *grows)
 {
-    struct token token = { TOKEN_ERROR, "" };
-    size_t len = strlen(lexer->input);
-    int yes = 0;
-    if (lexer->pos >= len)
+    struct token token = { TOKEN_ERROR, lexer->pos, 0, NULL };
+    *grows = !(lexer->pos < lexer->len
+               && is_class(lexer->input[lexer->pos], CC_SYMBOL));
+    if (lexer->pos >= lexer->len)
         token.type = TOKEN_EOF;
-    else if (lexer->input[lexer->pos] == ';' || lexer->input[lexer->pos] == '\n'
-             || lexer->input[lexer->pos] == '!'
-             || lexer->input[lexer->pos] == '{'
-             || lexer->input[lexer->pos] == '}'
-             || lexer->input[lexer->pos] == '('
-             || lexer->input[lexer->pos] == ')')
+    else if (is_class(lexer->input[lexer->pos], CC_SYMBOL))
     {
         token.type = symbol_care(lexer->input[lexer->pos]);
         lexer->pos++;
     }
-    else if (to_pipe(lexer, &token))
-        yes = 0;
-    else if (to_esp(lexer, &token))
-        yes = 0;
-    else if (lexer->input[lexer->pos] == '<' || lexer->input[lexer->pos] == '>')
+    else if (to_pipe(lexer, &token) || to_esp(lexer, &token))
+        token.len = 0;
+    else if (is_class(lexer->input[lexer->pos], CC_REDIR))
     {
-        token.data = redir_care(lexer, len);
+        token.offset = lexer->pos;
+        token.len = redir_care(lexer);
         token.type = TOKEN_REDIR;
     }
     else if (lexer->input[lexer->pos] != '#')
     {
-        if (lexer->input[lexer->pos] == '\'')
-            yes = 1;
-        token.data = to_str(lexer, len);
-        if (yes)
-            token.type = TOKEN_WORD;
-        else if (strstr(token.data, "="))
-            token = assignment_care(token);
+        to_str(lexer, &token);
+        const char *text = token_text(lexer, token);
+        if (memchr(text, '=', token.len))
+            token = assignment_care(token, text);
         else
-            token.type = word_care(token.data);
+            token.type = word_care(text, token.len);
     }
     else if (lexer->input[lexer->pos] == '#')
     {
         token.type = TOKEN_BACKSLASH;
         lexer->pos++;
-        skip(lexer, len, '\n');
+        skip(lexer, '\n');
     }
     else
         fprintf(stderr, "parse_input_for_tok: token is not valid\n");
-    skip(lexer, len, ' ');
-    lexer->current_tok = token;
+    *grows = *grows && lexer->pos >= lexer->len;
+    skip(lexer, ' ');
     return token;
 }
 
+struct token parse_input_for_tok(struct lexer *lexer)
+{
+    size_t start = lexer->pos;
+    int grows = 0;
+    struct token token = lex_token(lexer, &grows);
+    while (grows && lexer->fd >= 0)
+    {
+        token_free(token);
+        lexer->pos = start;
+        refill(lexer);
+        token = lex_token(lexer, &grows);
+    }
+    return token;
+}
+
+static struct lookahead *lookahead(struct lexer *lexer)
+{
+    lexer->lookups++;
+    for (int i = 0; i < LEXER_LOOKAHEAD; i++)
+        if (lexer->ahead[i].valid && lexer->ahead[i].start == lexer->pos)
+            return &lexer->ahead[i];
+    lexer->last = (lexer->last + 1) % LEXER_LOOKAHEAD;
+    struct lookahead *slot = &lexer->ahead[lexer->last];
+    if (slot->valid)
+        token_free(slot->token);
+    slot->start = lexer->pos;
+    slot->token = parse_input_for_tok(lexer);
+    lexer->scans++;
+    slot->end = lexer->pos;
+    slot->valid = 1;
+    lexer->pos = slot->start;
+    return slot;
+}
+
 struct token lexer_peek(struct lexer *lexer)
 {
-    int keep = lexer->pos;
-    struct token token = parse_input_for_tok(lexer);
-    lexer->pos = keep;
+    struct lookahead *slot = lookahead(lexer);
+    struct token token = slot->token;
+    if (token.data)
+    {
+        token.data = calloc(token.len + 1, sizeof(char));
+        memcpy(token.data, slot->token.data, token.len);
+    }
     return token;
 }
 
 void lexer_pop(struct lexer *lexer)
 {
-    struct token to_free = parse_input_for_tok(lexer);
-    token_free(to_free);
+    lexer->pos = lookahead(lexer)->end;
+}
+
+const char *token_text(const struct lexer *lexer, struct token token)
+{
+    if (token.data)
+        return token.data;
+    return lexer->input + token.offset;
+}
+
+char *token_str(const struct lexer *lexer, struct token token)
+{
+    if (token.data)
+        return token.data;
+    char *res = calloc(token.len + 1, sizeof(char));
+    if (!res)
+        return NULL;
+    return memcpy(res, lexer->input + token.offset, token.len);
 }
 
 void token_free(struct token token)
 {
-    if (token.type == TOKEN_WORD)
-        free(token.data);
-    else if (strcmp(token.data, ""))
-        free(token.data);
+    free(token.data);
 }
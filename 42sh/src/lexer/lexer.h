@@ -18,20 +18,83 @@
  *   - TOKEN_NUMBER { .value = 3 }
  */
 
+/**
+ * A token the lexer already produced, remembered with the offsets it spans so
+ * that peeking it again, popping it, or coming back to it after the parser
+ * rewound pos does not scan the input a second time.
+ */
+struct lookahead
+{
+    struct token token; // The token, its data is owned by the lexer
+    size_t start; // Offset the token was lexed from
+    size_t end; // Offset after the token and the blanks following it
+    int valid; // Whether this slot holds a token
+};
+
+#define LEXER_LOOKAHEAD 2
+#define LEXER_CHUNK 16384
+
+/*
+ * How deep parameters, commands and arithmetic expressions may nest in a
+ * word. Finding where they end recurses on the C stack, so this bounds the
+ * stack it uses.
+ */
+#ifndef LEXER_MAX_DEPTH
+#define LEXER_MAX_DEPTH 10000
+#endif
+
+/**
+ * The input is either fully in memory, or read from a file descriptor into a
+ * buffer the lexer owns. In the latter case input only holds a window of the
+ * stream: it is refilled when a token reaches its end, and what was consumed
+ * is dropped by lexer_discard once the buffer is half used.
+ */
 struct lexer
 {
-    const char *input; // The input data
+    const char *input; // The input data, not necessarily NUL-terminated
+    size_t len; // The length of the input data
     size_t pos; // The current offset inside the input data
-    struct token current_tok; // The next token, if processed
+    struct lookahead ahead[LEXER_LOOKAHEAD]; // Tokens already processed
+    int last; // Slot filled most recently
+    int fd; // Stream still to be read, -1 when the input is complete
+    char *buffer; // Storage for input when reading from fd
+    size_t capacity; // Size of buffer
+    size_t base; // Offset of input[0] inside the stream
+    int owned_fd; // File descriptor to close with the lexer, or -1
+    int mapped; // Whether input is a mapping of a file
+    size_t lookups; // Tokens asked for by lexer_peek and lexer_pop
+    size_t scans; // Tokens lexed from the input, lookahead hits excluded
 };
 
 /**
- * \brief Creates a new lexer given an input string.
+ * \brief Creates a new lexer over the len bytes of input. The input does not
+ * have to be NUL-terminated and may contain NUL bytes.
  */
-struct lexer *lexer_new(const char *input);
+struct lexer *lexer_new(const char *input, size_t len);
 
 /**
- ** \brief Free the given lexer, but not its input.
+ * \brief Creates a new lexer reading its input from fd as it needs it, which
+ * works on pipes and keeps memory bounded by the largest command.
+ */
+struct lexer *lexer_new_fd(int fd);
+
+/**
+ * \brief Creates a new lexer over the file at path. Regular files are mapped
+ * in memory and lexed in place; pipes and special files are read as a stream
+ * like lexer_new_fd does. Returns NULL if the file cannot be opened.
+ */
+struct lexer *lexer_new_file(const char *path);
+
+/**
+ * \brief Tells the lexer that nothing before pos will be looked at again, so
+ * it may drop that part of a streamed input. It is called between two
+ * commands: positions and tokens obtained before are no longer valid.
+ */
+void lexer_discard(struct lexer *lexer);
+
+/**
+ ** \brief Free the given lexer, but not the input or file descriptor it was
+ ** given. What lexer_new_file opened or mapped is released.
  */
 void lexer_free(struct lexer *lexer);
 
@@ -47,15 +110,34 @@ struct token parse_input_for_tok(struct lexer *lexer);
  * \brief Returns the next token, but doesn't move forward: calling lexer_peek
  * multiple times in a row always returns the same result. This functions is
  * meant to help the parser check if the next token matches some rule.
+ * The token is only scanned once, the caller gets its own copy of any
+ * rewritten text and still has to token_free it.
  */
 struct token lexer_peek(struct lexer *lexer);
 
 /**
  * \brief Returns the next token, and removes it from the stream:
  *   calling lexer_pop in a loop will iterate over all tokens until EOF.
+ *   Popping a token that was just peeked only moves pos forward.
  */
 void lexer_pop(struct lexer *lexer);
 
+/**
+ * \brief Returns the token.len bytes of text of the token. They are not
+ * NUL-terminated unless the lexer had to rewrite them.
+ */
+const char *token_text(const struct lexer *lexer, struct token token);
+
+/**
+ * \brief Returns the text of the token as a NUL-terminated string owned by the
+ * caller. A rewritten text is handed over instead of being copied, so the
+ * token must not be freed afterwards.
+ */
+char *token_str(const struct lexer *lexer, struct token token);
+
+/**
+ ** \brief Releases the text the lexer had to rewrite for this token, if any.
+ */
 void token_free(struct token token);
 
 #endif /* !LEXER_H */
@@ -0,0 +1,188 @@
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// Bytes looked at one by one before switching to vectors
+#define SCAN_PREFIX 16
+
+void scan_set_init(struct scan_set *set, const char *chars)
+{
+    memset(set, 0, sizeof(*set));
+    for (int i = 0; chars[i] && i < SCAN_SET_MAX; i++)
+    {
+        unsigned char c = chars[i];
+        set->table[c] = 1;
+        set->nibbles[c & 0xf] |= 1 << (c >> 4);
+        set->chars[i] = c;
+    }
+}
+
+static size_t until_scalar(const char *s, size_t len,
+                           const struct scan_set *set)
+{
+    size_t i = 0;
+    while (i < len && !set->table[(unsigned char)s[i]])
+        i++;
+    return i;
+}
+
+static size_t while_scalar(const char *s, size_t len, char c)
+{
+    size_t i = 0;
+    while (i < len && s[i] == c)
+        i++;
+    return i;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2"))) static size_t
+until_sse2(const char *s, size_t len, const struct scan_set *set)
+{
+    __m128i needles[SCAN_SET_MAX];
+    int nb = 0;
+    for (; set->chars[nb]; nb++)
+        needles[nb] = _mm_set1_epi8(set->chars[nb]);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hit = _mm_cmpeq_epi8(block, needles[0]);
+        for (int j = 1; j < nb; j++)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[j]));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + until_scalar(s + i, len - i, set);
+}
+
+__attribute__((target("sse2"))) static size_t
+while_sse2(const char *s, size_t len, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + while_scalar(s + i, len - i, c);
+}
+
+/*
+ * A byte is in the set when the bit of its high nibble is set in the bitmap
+ * of its low nibble: two table lookups done 32 bytes at a time by vpshufb.
+ * Bytes above 0x7f have no bit and never match.
+ */
+__attribute__((target("avx2"))) static size_t
+until_avx2(const char *s, size_t len, const struct scan_set *set)
+{
+    __m128i nibbles = _mm_loadu_si128((const __m128i *)set->nibbles);
+    __m256i lo_table = _mm256_broadcastsi128_si256(nibbles);
+    __m256i hi_table = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16,
+        32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i low_mask = _mm256_set1_epi8(0xf);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i lo = _mm256_and_si256(block, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(block, 4), low_mask);
+        __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_table, lo),
+                                        _mm256_shuffle_epi8(hi_table, hi));
+        __m256i miss = _mm256_cmpeq_epi8(bits, _mm256_setzero_si256());
+        unsigned mask = ~_mm256_movemask_epi8(miss);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + until_scalar(s + i, len - i, set);
+}
+
+__attribute__((target("avx2"))) static size_t
+while_avx2(const char *s, size_t len, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + while_scalar(s + i, len - i, c);
+}
+
+#endif /* SCAN_X86 */
+
+static size_t until_init(const char *s, size_t len,
+                         const struct scan_set *set);
+static size_t while_init(const char *s, size_t len, char c);
+
+static size_t (*until_impl)(const char *, size_t, const struct scan_set *) =
+    until_init;
+static size_t (*while_impl)(const char *, size_t, char) = while_init;
+
+enum scan_level scan_select(enum scan_level max)
+{
+    until_impl = until_scalar;
+    while_impl = while_scalar;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (max >= SCAN_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        until_impl = until_avx2;
+        while_impl = while_avx2;
+        return SCAN_AVX2;
+    }
+    if (max >= SCAN_SSE2 && __builtin_cpu_supports("sse2"))
+    {
+        until_impl = until_sse2;
+        while_impl = while_sse2;
+        return SCAN_SSE2;
+    }
+#else
+    (void)max;
+#endif
+    return SCAN_SCALAR;
+}
+
+static size_t until_init(const char *s, size_t len,
+                         const struct scan_set *set)
+{
+    scan_select(SCAN_AVX2);
+    return until_impl(s, len, set);
+}
+
+static size_t while_init(const char *s, size_t len, char c)
+{
+    scan_select(SCAN_AVX2);
+    return while_impl(s, len, c);
+}
+
+size_t scan_until(const char *s, size_t len, const struct scan_set *set)
+{
+    size_t prefix = len < SCAN_PREFIX ? len : SCAN_PREFIX;
+    size_t i = until_scalar(s, prefix, set);
+    if (i < prefix || i == len)
+        return i;
+    return i + until_impl(s + i, len - i, set);
+}
+
+size_t scan_while(const char *s, size_t len, char c)
+{
+    size_t prefix = len < SCAN_PREFIX ? len : SCAN_PREFIX;
+    size_t i = while_scalar(s, prefix, c);
+    if (i < prefix || i == len)
+        return i;
+    return i + while_impl(s + i, len - i, c);
+}
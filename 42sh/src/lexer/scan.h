@@ -0,0 +1,59 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <unistd.h>
+
+/**
+ * \page Scan
+ *
+ * Helpers the lexer uses to jump over runs of bytes that need no attention
+ * (the body of a word, a quoted string, a comment, blanks). The first bytes
+ * are looked at one by one, as most words are short; longer runs are scanned
+ * with SSE2 or AVX2 when the CPU has them. The implementation is picked on the
+ * first call.
+ */
+
+#define SCAN_SET_MAX 16
+
+enum scan_level
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+/**
+ * A set of at most SCAN_SET_MAX ASCII characters to stop on, prepared for
+ * every implementation.
+ */
+struct scan_set
+{
+    unsigned char table[256]; // Non zero for the characters of the set
+    unsigned char nibbles[16]; // Per low nibble, a bit per high nibble
+    char chars[SCAN_SET_MAX + 1]; // The characters of the set
+};
+
+/**
+ * \brief Fills set with the characters of chars.
+ */
+void scan_set_init(struct scan_set *set, const char *chars);
+
+/**
+ * \brief Selects the best implementation supported by the CPU that is not
+ * above max, and returns it.
+ */
+enum scan_level scan_select(enum scan_level max);
+
+/**
+ * \brief Returns the offset of the first of the len bytes at s that is in
+ * set, or len if there is none.
+ */
+size_t scan_until(const char *s, size_t len, const struct scan_set *set);
+
+/**
+ * \brief Returns the offset of the first of the len bytes at s that is not c,
+ * or len if they all are.
+ */
+size_t scan_while(const char *s, size_t len, char c);
+
+#endif /* !SCAN_H */
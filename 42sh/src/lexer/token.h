@@ -35,9 +35,17 @@ enum token_type
     TOKEN_ERROR, // it is not a real token, invalid token
 };
 
+/**
+ * A token does not own its text: it is a slice (offset, len) of the lexer
+ * input. Words keep their quotes and backslashes, which are removed when they
+ * are expanded. data holds text of its own for a token whose slice cannot be
+ * used.
+ */
 struct token
 {
     enum token_type type; // The kind of token
-    char *data; // If the token is a number, its value
+    size_t offset; // Start of the token text inside the lexer input
+    size_t len; // Length of the token text, 0 for operators
+    char *data; // Rewritten text if the input slice could not be used
 };
 #endif /* !TOKEN_H */
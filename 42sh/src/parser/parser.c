@@ -28,49 +28,128 @@ static enum parser_status parse_rule_for(struct ast **res, struct lexer *lexer);
 static enum parser_status parse_functions(struct ast **res,
                                           struct lexer *lexer);
 
+// Arena of the command being parsed, it owns every node, array and word
+static struct arena *arena = NULL;
+// Compound commands, elif branches and redirections or assignments wrapping
+// a command, open around the token being parsed
+static int depth = 0;
+// Deepest level reached by the command being parsed, its own nodes included
+static int reached = 0;
+static int too_deep = 0;
+
 static struct ast *create_ast(enum ast_type type, char *data)
 {
-    struct ast *new = calloc(1, sizeof(struct ast));
+    struct ast *new = arena_alloc(arena, sizeof(struct ast));
     new->type = type;
     if (strcmp(data, ""))
     {
-        new->data = calloc(1, sizeof(char *));
+        new->data = arena_alloc(arena, 2 * sizeof(char *));
         new->data[0] = data;
         new->nb_data = 1;
+        new->expand = word_expands(data);
     }
     return new;
 }
 
+/*
+ * Copies the text of a word into the arena and releases the token.
+ */
+static char *word(struct lexer *lexer, struct token token)
+{
+    char *res = arena_strndup(arena, token_text(lexer, token), token.len);
+    token_free(token);
+    return res;
+}
+
+/*
+ * Arrays double when their size reaches a power of two, so a node with n
+ * children or words costs about log(n) allocations.
+ */
+static void *grow(void *array, int nb, size_t size)
+{
+    if (nb & (nb - 1))
+        return array;
+    size_t cap = nb ? 2 * nb : 1;
+    return arena_realloc(arena, array, nb * size, cap * size);
+}
+
+/*
+ * Goes one nesting level deeper, and returns 0 past PARSER_MAX_DEPTH levels.
+ * Nested nodes recurse in the evaluator, the optimizer and ast_free, so a
+ * command that deep is rejected instead of letting the C stack overflow.
+ */
+static int deeper(void)
+{
+    if (depth >= PARSER_MAX_DEPTH)
+    {
+        too_deep = 1;
+        return 0;
+    }
+    depth++;
+    if (depth > reached)
+        reached = depth;
+    return 1;
+}
+
+/*
+ * Parses a compound command, or an elif branch, one nesting level deeper.
+ * Nested commands recurse here as well.
+ */
+static enum parser_status
+nested(enum parser_status (*rule)(struct ast **, struct lexer *),
+       struct ast **res, struct lexer *lexer)
+{
+    if (!deeper())
+        return PARSER_UNEXPECTED_TOKEN;
+    enum parser_status status = rule(res, lexer);
+    depth--;
+    return status;
+}
+
 static void free_pop(struct token token, struct lexer *lexer)
 {
     token_free(token);
     lexer_pop(lexer);
 }
 
-static enum parser_status free_all(struct ast **res, struct lexer *lexer,
-                                   struct token token)
+static enum parser_status free_all(struct ast **res, struct token token)
 {
     token_free(token);
-    if (lexer->pos != 0 && *res)
-        ast_free(*res);
+    arena_free(arena);
+    arena = NULL;
     *res = NULL;
+    if (too_deep)
+    {
+        fprintf(stderr, "Nested deeper than %d levels\n", PARSER_MAX_DEPTH);
+        return PARSER_TOO_DEEP;
+    }
+    fprintf(stderr, "Error on parsing\n");
     return PARSER_UNEXPECTED_TOKEN;
 }
 
 struct ast *add_child(struct ast *parent, struct ast *child)
 {
     parent->ast_list =
-        realloc(parent->ast_list, (parent->nb_ast + 1) * sizeof(struct ast));
+        grow(parent->ast_list, parent->nb_ast, sizeof(struct ast *));
     parent->ast_list[parent->nb_ast] = child;
     parent->nb_ast++;
     return parent;
 }
 
-struct ast *add_data(struct ast *ast, char *data)
+/*
+ * Words are followed by a NULL, so that the words of a command that has
+ * nothing to expand are the argv it runs with. The array doubles when the
+ * words and the NULL reach a power of two.
+ */
+static struct ast *add_data(struct ast *ast, char *data)
 {
-    ast->data = realloc(ast->data, (ast->nb_data + 1) * sizeof(char *));
+    int nb = ast->nb_data + 1;
+    if (!(nb & (nb - 1)))
+        ast->data = arena_realloc(arena, ast->data, nb * sizeof(char *),
+                                  2 * nb * sizeof(char *));
     ast->data[ast->nb_data] = data;
     ast->nb_data++;
+    ast->expand += word_expands(data);
     return ast;
 }
 
@@ -79,19 +158,19 @@ enum parser_status parse(struct ast **res, struct lexer *lexer)
     struct token token = lexer_peek(lexer);
     if (token.type == TOKEN_EOF || token.type == TOKEN_BACKSLASH)
         return PARSER_OK;
+    arena = arena_new();
+    depth = 0;
+    reached = 0;
+    too_deep = 0;
     if (parse_list(res, lexer) != PARSER_OK)
-    {
-        fprintf(stderr, "Error on parsing\n");
-        return free_all(res, lexer, token);
-    }
+        return free_all(res, token);
     token_free(token);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_EOF && token.type != TOKEN_BACKSLASH)
-    {
-        fprintf(stderr, "Error on parsing\n");
-        return free_all(res, lexer, token);
-    }
+        return free_all(res, token);
     token_free(token);
+    (*res)->arena = arena;
+    arena = NULL;
     return PARSER_OK;
 }
 
@@ -103,10 +182,7 @@ static enum parser_status parse_list(struct ast **res, struct lexer *lexer)
     if (token.type == TOKEN_ERROR)
         return PARSER_UNEXPECTED_TOKEN;
     struct ast *ast = create_ast(AST_LIST, "");
-    ast->ast_list =
-        realloc(ast->ast_list, (ast->nb_ast + 1) * sizeof(struct ast));
-    ast->ast_list[ast->nb_ast] = *res;
-    ast->nb_ast++;
+    ast = add_child(ast, *res);
     while (token.type == TOKEN_SEMI_COLON)
     {
         token_free(token);
@@ -118,10 +194,7 @@ static enum parser_status parse_list(struct ast **res, struct lexer *lexer)
             *res = keep;
             break;
         }
-        ast->ast_list =
-            realloc(ast->ast_list, (ast->nb_ast + 1) * sizeof(struct ast));
-        ast->ast_list[ast->nb_ast] = new_ast;
-        ast->nb_ast++;
+        ast = add_child(ast, new_ast);
         token = lexer_peek(lexer);
     }
     token_free(token);
@@ -167,11 +240,7 @@ static enum parser_status parse_and_or(struct ast **res, struct lexer *lexer)
         token_free(token);
         child = NULL;
         if (parse_pipeline(&child, lexer) != PARSER_OK)
-        {
-            ast_free(ast);
-            ast_free(child);
             return PARSER_UNEXPECTED_TOKEN;
-        }
         ast = add_child(ast, child);
         token = lexer_peek(lexer);
     }
@@ -195,10 +264,7 @@ static enum parser_status parse_pipeline(struct ast **res, struct lexer *lexer)
     }
     token_free(token);
     if (parse_command(&child, lexer) != PARSER_OK)
-    {
-        ast_free(neg);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     token = lexer_peek(lexer);
     if (token.type == TOKEN_PIPE)
     {
@@ -217,11 +283,7 @@ static enum parser_status parse_pipeline(struct ast **res, struct lexer *lexer)
         token_free(token);
         child = NULL;
         if (parse_command(&child, lexer) != PARSER_OK)
-        {
-            ast_free(ast);
-            ast_free(child);
             return PARSER_UNEXPECTED_TOKEN;
-        }
         ast = add_child(ast, child);
         token = lexer_peek(lexer);
     }
@@ -238,45 +300,92 @@ static enum parser_status parse_pipeline(struct ast **res, struct lexer *lexer)
     return PARSER_OK;
 }
 
-static enum parser_status parse_command(struct ast **res, struct lexer *lexer)
+static enum token_type peek_type(struct lexer *lexer)
+{
+    struct token token = lexer_peek(lexer);
+    token_free(token);
+    return token.type;
+}
+
+/*
+ * A word followed by ( starts a function definition. The lexer keeps both
+ * tokens, so looking one token further and coming back costs no scan.
+ */
+static int is_function(struct lexer *lexer)
 {
     size_t keep_pos = lexer->pos;
-    struct ast *shell = NULL;
-    if (parse_shell_command(&shell, lexer) == PARSER_OK)
-    {
-        size_t keep_pos = lexer->pos;
-        struct ast *child = NULL;
-        while (parse_redirection(&child, lexer) == PARSER_OK)
-        {
-            child = add_child(child, shell);
-            shell = child;
-            child = NULL;
-            keep_pos = lexer->pos;
-        }
-        lexer->pos = keep_pos;
-        *res = shell;
-        return PARSER_OK;
-    }
+    lexer_pop(lexer);
+    enum token_type type = peek_type(lexer);
     lexer->pos = keep_pos;
-    if (parse_functions(&shell, lexer) == PARSER_OK)
+    return type == TOKEN_LEFT_PARENTHESIS;
+}
+
+/*
+ * Each redirection wraps the command before it, one level above the deepest
+ * node of the command.
+ */
+static enum parser_status parse_redirections(struct ast **res,
+                                             struct ast *shell,
+                                             struct lexer *lexer)
+{
+    size_t keep_pos = lexer->pos;
+    struct ast *child = NULL;
+    int outer = depth;
+    depth = reached;
+    enum parser_status status = PARSER_OK;
+    while (parse_redirection(&child, lexer) == PARSER_OK)
     {
-        size_t keep_pos = lexer->pos;
-        struct ast *child = NULL;
-        while (parse_redirection(&child, lexer) == PARSER_OK)
+        if (!deeper())
         {
-            child = add_child(child, shell);
-            shell = child;
-            child = NULL;
-            keep_pos = lexer->pos;
+            status = PARSER_UNEXPECTED_TOKEN;
+            break;
         }
-        lexer->pos = keep_pos;
-        *res = shell;
-        return PARSER_OK;
+        child = add_child(child, shell);
+        shell = child;
+        child = NULL;
+        keep_pos = lexer->pos;
     }
+    depth = outer;
     lexer->pos = keep_pos;
-    if (parse_simple_command(res, lexer) == PARSER_OK)
-        return PARSER_OK;
-    return PARSER_UNEXPECTED_TOKEN;
+    *res = shell;
+    return status;
+}
+
+/*
+ * The first token, and the second one for a word, tell which kind of command
+ * follows, so that no production is tried and then rewound. The deepest
+ * level the command reaches counts for the commands around it.
+ */
+static enum parser_status parse_command(struct ast **res, struct lexer *lexer)
+{
+    struct ast *shell = NULL;
+    int mark = reached;
+    reached = depth;
+    enum parser_status status = PARSER_UNEXPECTED_TOKEN;
+    switch (peek_type(lexer))
+    {
+    case TOKEN_IF:
+    case TOKEN_WHILE:
+    case TOKEN_UNTIL:
+    case TOKEN_FOR:
+    case TOKEN_LEFT_BRACKET:
+    case TOKEN_LEFT_PARENTHESIS:
+        if (parse_shell_command(&shell, lexer) == PARSER_OK)
+            status = parse_redirections(res, shell, lexer);
+        break;
+    case TOKEN_WORD:
+        if (!is_function(lexer))
+            status = parse_simple_command(res, lexer);
+        else if (parse_functions(&shell, lexer) == PARSER_OK)
+            status = parse_redirections(res, shell, lexer);
+        break;
+    default:
+        status = parse_simple_command(res, lexer);
+        break;
+    }
+    if (reached < mark)
+        reached = mark;
+    return status;
 }
 
 static struct token pop_peek(struct token token, struct lexer *lexer,
@@ -291,12 +400,28 @@ static struct token pop_peek(struct token token, struct lexer *lexer,
     return token;
 }
 
+static int is_redirection(enum token_type type)
+{
+    return type == TOKEN_REDIR || type == TOKEN_IONUMBER;
+}
+
 static int cond(struct token token)
 {
-    return ((strcmp(token.data, "") || token.type == TOKEN_WORD)
+    return ((token.len || token.type == TOKEN_WORD)
             && token.type != TOKEN_REDIR);
 }
 
+// Gives up on a simple command nested too deeply, back at depth outer
+static enum parser_status too_deep_command(int outer)
+{
+    depth = outer;
+    return PARSER_UNEXPECTED_TOKEN;
+}
+
+/*
+ * Each prefix and each redirection after the name wraps the nodes before it,
+ * one level deeper.
+ */
 static enum parser_status parse_simple_command(struct ast **res,
                                                struct lexer *lexer)
 {
@@ -304,8 +429,11 @@ static enum parser_status parse_simple_command(struct ast **res,
     struct ast *ast_pre = NULL;
     struct ast *child = NULL;
     size_t keep_pos = lexer->pos;
+    int outer = depth;
     while (parse_prefix(&child, lexer) == PARSER_OK)
     {
+        if (!deeper())
+            return too_deep_command(outer);
         if (!ast_pre)
             ast_pre = child;
         else
@@ -321,6 +449,7 @@ static enum parser_status parse_simple_command(struct ast **res,
     struct token token = lexer_peek(lexer);
     if (token.type != TOKEN_WORD)
     {
+        depth = outer;
         if (prefix)
         {
             *res = ast_pre;
@@ -329,27 +458,35 @@ static enum parser_status parse_simple_command(struct ast **res,
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
-    struct ast *ast = create_ast(AST_COMMAND, token.data);
+    struct ast *ast = create_ast(AST_COMMAND, word(lexer, token));
     token = pop_peek(token, lexer, &keep_pos);
     child = NULL;
     keep_pos = lexer->pos;
-    while (cond(token) || parse_redirection(&child, lexer) == PARSER_OK)
+    while (cond(token)
+           || (is_redirection(token.type)
+               && parse_redirection(&child, lexer) == PARSER_OK))
     {
         if (child)
         {
+            if (!deeper())
+            {
+                token_free(token);
+                return too_deep_command(outer);
+            }
             child = add_child(child, ast);
             ast = child;
             child = NULL;
         }
         else
         {
-            ast = add_data(ast, token.data);
+            ast = add_data(ast, word(lexer, token));
             token = pop_peek(token, lexer, NULL);
         }
         keep_pos = lexer->pos;
     }
     if (ast_pre)
         ast = add_child(ast_pre, ast);
+    depth = outer;
     lexer->pos = keep_pos;
     token_free(token);
     *res = ast;
@@ -361,12 +498,13 @@ static enum parser_status parse_prefix(struct ast **res, struct lexer *lexer)
     struct token token = lexer_peek(lexer);
     if (token.type == TOKEN_ASSIGNMENT_WORD)
     {
-        *res = create_ast(AST_ASSIGNMENT_WORD, token.data);
+        *res = create_ast(AST_ASSIGNMENT_WORD, word(lexer, token));
         lexer_pop(lexer);
         return PARSER_OK;
     }
     token_free(token);
-    if (parse_redirection(res, lexer) == PARSER_OK)
+    if (is_redirection(token.type)
+        && parse_redirection(res, lexer) == PARSER_OK)
         return PARSER_OK;
     return PARSER_UNEXPECTED_TOKEN;
 }
@@ -387,16 +525,15 @@ static enum parser_status parse_redirection(struct ast **res,
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
-    struct ast *ast = create_ast(AST_REDIR, token.data);
+    struct ast *ast = create_ast(AST_REDIR, word(lexer, token));
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_WORD)
     {
-        ast_free(ast);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
-    ast = add_data(ast, token.data);
+    ast = add_data(ast, word(lexer, token));
     lexer_pop(lexer);
     *res = ast;
     return PARSER_OK;
@@ -425,7 +562,6 @@ static enum parser_status parse_shell_command2(struct ast **res,
             token_free(token);
             lexer_pop(lexer);
         }
-        ast_free(child);
         child = NULL;
     }
     else if (token.type == TOKEN_LEFT_PARENTHESIS)
@@ -446,7 +582,6 @@ static enum parser_status parse_shell_command2(struct ast **res,
             token_free(token);
             lexer_pop(lexer);
         }
-        ast_free(child);
         token_free(token);
     }
     else
@@ -457,25 +592,19 @@ static enum parser_status parse_shell_command2(struct ast **res,
 static enum parser_status parse_shell_command(struct ast **res,
                                               struct lexer *lexer)
 {
-    struct ast *keep = *res;
-    size_t keep_pos = lexer->pos;
-    if (parse_rule_if(res, lexer) == PARSER_OK)
-        return PARSER_OK;
-    *res = keep;
-    lexer->pos = keep_pos;
-    if (parse_rule_while(res, lexer) == PARSER_OK)
-        return PARSER_OK;
-    *res = keep;
-    lexer->pos = keep_pos;
-    if (parse_rule_until(res, lexer) == PARSER_OK)
-        return PARSER_OK;
-    *res = keep;
-    lexer->pos = keep_pos;
-    if (parse_rule_for(res, lexer) == PARSER_OK)
-        return PARSER_OK;
-    *res = keep;
-    lexer->pos = keep_pos;
-    return parse_shell_command2(res, lexer);
+    switch (peek_type(lexer))
+    {
+    case TOKEN_IF:
+        return nested(parse_rule_if, res, lexer);
+    case TOKEN_WHILE:
+        return nested(parse_rule_while, res, lexer);
+    case TOKEN_UNTIL:
+        return nested(parse_rule_until, res, lexer);
+    case TOKEN_FOR:
+        return nested(parse_rule_for, res, lexer);
+    default:
+        return nested(parse_shell_command2, res, lexer);
+    }
 }
 
 static enum parser_status parse_rule_while(struct ast **res,
@@ -492,10 +621,7 @@ static enum parser_status parse_rule_while(struct ast **res,
     struct ast *child = NULL;
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     struct ast *new_ast = create_ast(AST_WHILE, "");
     new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
@@ -503,21 +629,15 @@ static enum parser_status parse_rule_while(struct ast **res,
     if (token.type != TOKEN_DO)
     {
         token_free(token);
-        ast_free(new_ast);
         return PARSER_UNEXPECTED_TOKEN;
     }
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_DONE)
     {
-        ast_free(new_ast);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
@@ -540,10 +660,7 @@ static enum parser_status parse_rule_until(struct ast **res,
     struct ast *child = NULL;
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     struct ast *new_ast = create_ast(AST_UNTIL, "");
     new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
@@ -551,21 +668,15 @@ static enum parser_status parse_rule_until(struct ast **res,
     if (token.type != TOKEN_DO)
     {
         token_free(token);
-        ast_free(new_ast);
         return PARSER_UNEXPECTED_TOKEN;
     }
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_DONE)
     {
-        ast_free(new_ast);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
@@ -585,42 +696,30 @@ static enum parser_status parse_rule_if(struct ast **res, struct lexer *lexer)
     struct ast *child = NULL;
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     struct ast *new_ast = create_ast(AST_IF, "");
     new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_THEN)
     {
         token_free(token);
-        ast_free(new_ast);
         return PARSER_UNEXPECTED_TOKEN;
     }
     child = NULL;
     free_pop(token, lexer);
     if (parse_compound_list(&child, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
-        ast_free(child);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     new_ast = add_child(new_ast, child);
     child = NULL;
     size_t keep_pos = lexer->pos;
     if (parse_else(&child, lexer) != PARSER_OK)
-    {
-        ast_free(child);
         lexer->pos = keep_pos;
-    }
     else
         new_ast = add_child(new_ast, child);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_FI)
     {
         token_free(token);
-        ast_free(new_ast);
         return PARSER_UNEXPECTED_TOKEN;
     }
     free_pop(token, lexer);
@@ -640,21 +739,19 @@ static enum parser_status parse_for_in_sequence(struct ast **ast_for,
     if (token.type != TOKEN_IN)
     {
         token_free(token);
-        ast_free(*ast_for);
         return PARSER_UNEXPECTED_TOKEN;
     }
     free_pop(token, lexer);
     token = lexer_peek(lexer);
     while (token.type == TOKEN_WORD)
     {
-        *ast_for = add_data(*ast_for, token.data);
+        *ast_for = add_data(*ast_for, word(lexer, token));
         lexer_pop(lexer);
         token = lexer_peek(lexer);
     }
     if (token.type != TOKEN_SEMI_COLON && token.type != TOKEN_BACKSLASH)
     {
         token_free(token);
-        ast_free(*ast_for);
         return PARSER_UNEXPECTED_TOKEN;
     }
     lexer_pop(lexer);
@@ -662,28 +759,6 @@ static enum parser_status parse_for_in_sequence(struct ast **ast_for,
     return PARSER_OK;
 }
 
-static enum parser_status parse_compound_list_or_free(struct ast **child,
-                                                      struct ast **parent,
-                                                      struct lexer *lexer)
-{
-    if (parse_compound_list(child, lexer) != PARSER_OK)
-    {
-        ast_free(*child);
-        ast_free(*parent);
-        return PARSER_UNEXPECTED_TOKEN;
-    }
-    return PARSER_OK;
-}
-
-static enum parser_status
-handle_done_error(struct ast **ast_for, struct ast **child, struct token *token)
-{
-    ast_free(*ast_for);
-    ast_free(*child);
-    token_free(*token);
-    return PARSER_UNEXPECTED_TOKEN;
-}
-
 static enum parser_status parse_rule_for(struct ast **res, struct lexer *lexer)
 {
     struct token token = lexer_peek(lexer);
@@ -699,7 +774,7 @@ static enum parser_status parse_rule_for(struct ast **res, struct lexer *lexer)
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
-    struct ast *ast_for = create_ast(AST_FOR, token.data);
+    struct ast *ast_for = create_ast(AST_FOR, word(lexer, token));
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     if (token.type == TOKEN_SEMI_COLON)
@@ -722,17 +797,19 @@ static enum parser_status parse_rule_for(struct ast **res, struct lexer *lexer)
     if (token.type != TOKEN_DO)
     {
         token_free(token);
-        ast_free(ast_for);
         return PARSER_UNEXPECTED_TOKEN;
     }
     free_pop(token, lexer);
     struct ast *child = NULL;
-    if (parse_compound_list_or_free(&child, &ast_for, lexer) != PARSER_OK)
+    if (parse_compound_list(&child, lexer) != PARSER_OK)
         return PARSER_UNEXPECTED_TOKEN;
     ast_for = add_child(ast_for, child);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_DONE)
-        return handle_done_error(&ast_for, &child, &token);
+    {
+        token_free(token);
+        return PARSER_UNEXPECTED_TOKEN;
+    }
     free_pop(token, lexer);
     *res = ast_for;
     return PARSER_OK;
@@ -752,10 +829,7 @@ static enum parser_status parse_else(struct ast **res, struct lexer *lexer)
     free_pop(token, lexer);
     struct ast *new_ast = NULL;
     if (parse_compound_list(&new_ast, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     if (is_else)
     {
         *res = new_ast;
@@ -764,7 +838,6 @@ static enum parser_status parse_else(struct ast **res, struct lexer *lexer)
     token = lexer_peek(lexer);
     if (token.type != TOKEN_THEN)
     {
-        ast_free(new_ast);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
@@ -773,19 +846,12 @@ static enum parser_status parse_else(struct ast **res, struct lexer *lexer)
     if_ast = add_child(if_ast, new_ast);
     new_ast = NULL;
     if (parse_compound_list(&new_ast, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
-        ast_free(if_ast);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     if_ast = add_child(if_ast, new_ast);
     size_t keep_pos = lexer->pos;
     new_ast = NULL;
-    if (parse_else(&new_ast, lexer) != PARSER_OK)
-    {
-        ast_free(new_ast);
+    if (nested(parse_else, &new_ast, lexer) != PARSER_OK)
         lexer->pos = keep_pos;
-    }
     else
         if_ast = add_child(if_ast, new_ast);
     *res = if_ast;
@@ -855,12 +921,11 @@ static enum parser_status parse_functions(struct ast **res, struct lexer *lexer)
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
-    struct ast *func = create_ast(AST_FUNCTION, token.data);
+    struct ast *func = create_ast(AST_FUNCTION, word(lexer, token));
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     if (token.type != TOKEN_LEFT_PARENTHESIS)
     {
-        ast_free(func);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
@@ -868,7 +933,6 @@ static enum parser_status parse_functions(struct ast **res, struct lexer *lexer)
     token = lexer_peek(lexer);
     if (token.type != TOKEN_RIGHT_PARENTHESIS)
     {
-        ast_free(func);
         token_free(token);
         return PARSER_UNEXPECTED_TOKEN;
     }
@@ -881,10 +945,7 @@ static enum parser_status parse_functions(struct ast **res, struct lexer *lexer)
     }
     token_free(token);
     if (parse_shell_command(res, lexer) != PARSER_OK)
-    {
-        ast_free(func);
         return PARSER_UNEXPECTED_TOKEN;
-    }
     func = add_child(func, (*res));
     *res = func;
     return PARSER_OK;
@@ -4,10 +4,21 @@
 #include "../ast/ast.h"
 #include "../lexer/lexer.h"
 
+/*
+ * How deep compound commands may nest, each if, loop, group or elif branch
+ * counting one level. Parsing and evaluating a nested command recurse on the
+ * C stack, so this bounds the stack they use: under 1 KiB a level, well
+ * within the usual 8 MiB.
+ */
+#ifndef PARSER_MAX_DEPTH
+#define PARSER_MAX_DEPTH 5000
+#endif
+
 enum parser_status
 {
     PARSER_OK,
     PARSER_UNEXPECTED_TOKEN,
+    PARSER_TOO_DEEP, // More than PARSER_MAX_DEPTH nested levels
 };
 
 struct ast *add_child(struct ast *parent, struct ast *child);
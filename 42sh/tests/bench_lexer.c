@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer/lexer.h"
+#include "lexer/scan.h"
+
+/*
+ * Lexer microbenchmark: lexes a generated script a few times and prints how
+ * many tokens per second lexer_peek/lexer_pop go through.
+ * Usage: ./bench_lexer [lines] [rounds] [scalar|sse2|avx2]
+ */
+
+static const char *lines[] = {
+    "if test -f $file; then echo found $file; else echo missing; fi\n",
+    "for i in a b c d e f; do echo \"item $i\" >> out.log; done\n",
+    "while read line; do process_line $line || break; done < input.txt\n",
+    "until false; do echo 'waiting for lock' && sleep 1; done\n",
+    "deploy() { echo deploying; cp -r build /srv/app; }\n",
+    "# generated banner: do not edit this file by hand\n",
+    "name=value; other=thing; echo $name $other | tr a-z A-Z\n",
+    "##################################################################"
+    "##################################################################\n",
+    "payload='H4sIAAAAAAAAA+3OMQ6AIBBE0d5TcAIRFOU4RHdNjIYEsfD2kGxpY2z"
+    "2V5NMXjHUi1u7SqGN7vW/aSdbUEqdVWxYm7sHYGlyKSa1qmp0u+o4W5N5mvzl'\n",
+    "echo \"checksum of the release archive is $sum and ready\" > log\n",
+};
+
+static char *generate(size_t nb_lines, size_t *len)
+{
+    size_t nb = sizeof(lines) / sizeof(*lines);
+    size_t size = 0;
+    for (size_t i = 0; i < nb_lines; i++)
+        size += strlen(lines[i % nb]);
+    char *script = malloc(size + 1);
+    if (!script)
+        return NULL;
+    size_t pos = 0;
+    for (size_t i = 0; i < nb_lines; i++)
+    {
+        size_t line_len = strlen(lines[i % nb]);
+        memcpy(script + pos, lines[i % nb], line_len);
+        pos += line_len;
+    }
+    script[pos] = 0;
+    *len = pos;
+    return script;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nb_lines = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (argc > 3)
+    {
+        enum scan_level level = SCAN_AVX2;
+        if (!strcmp(argv[3], "scalar"))
+            level = SCAN_SCALAR;
+        else if (!strcmp(argv[3], "sse2"))
+            level = SCAN_SSE2;
+        printf("scanning with level %d\n", scan_select(level));
+    }
+    size_t len = 0;
+    char *script = generate(nb_lines, &len);
+    if (!script)
+        return 1;
+    size_t tokens = 0;
+    double start = now();
+    for (int i = 0; i < rounds; i++)
+    {
+        struct lexer *lexer = lexer_new(script, len);
+        struct token token = lexer_peek(lexer);
+        while (token.type != TOKEN_EOF)
+        {
+            token_free(token);
+            lexer_pop(lexer);
+            tokens++;
+            token = lexer_peek(lexer);
+        }
+        lexer_free(lexer);
+    }
+    double elapsed = now() - start;
+    printf("%zu bytes, %zu tokens in %.3fs: %.0f tokens/s, %.1f MB/s\n",
+           len * rounds, tokens, elapsed, tokens / elapsed,
+           len * rounds / elapsed / 1e6);
+    free(script);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+
+/*
+ * Parser microbenchmark: parses a generated script one command at a time, the
+ * way evaluate_lexer does, and prints how many tokens the parser asked the
+ * lexer for, and how many the lexer had to scan, for every token of the
+ * script. It then parses commands nested deeper and deeper, up to
+ * PARSER_MAX_DEPTH, to show that the time per level stays the same.
+ * Usage: ./bench_parser [lines] [rounds]
+ */
+
+static const char *lines[] = {
+    "if test -f $file; then echo found $file; else echo missing; fi\n",
+    "for i in a b c d e f; do echo \"item $i\" >> out.log; done\n",
+    "while read line; do process_line $line || break; done < input.txt\n",
+    "until false; do echo 'waiting for lock' && sleep 1; done\n",
+    "deploy() { echo deploying; cp -r build /srv/app; }\n",
+    "name=value; other=thing; echo $name $other | tr a-z A-Z\n",
+    "{ echo a; echo b; } | tr b h > out.log\n",
+    "ls -l /tmp | grep log | sort | uniq | wc -l\n",
+    "echo one two three four five six seven eight nine ten\n",
+    "if true; then if false; then echo a; elif true; then echo b; fi; fi\n",
+};
+
+static char *generate(size_t nb_lines, size_t *len)
+{
+    size_t nb = sizeof(lines) / sizeof(*lines);
+    size_t size = 0;
+    for (size_t i = 0; i < nb_lines; i++)
+        size += strlen(lines[i % nb]);
+    char *script = malloc(size + 1);
+    if (!script)
+        return NULL;
+    size_t pos = 0;
+    for (size_t i = 0; i < nb_lines; i++)
+    {
+        size_t line_len = strlen(lines[i % nb]);
+        memcpy(script + pos, lines[i % nb], line_len);
+        pos += line_len;
+    }
+    script[pos] = 0;
+    *len = pos;
+    return script;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t count_tokens(const char *script, size_t len)
+{
+    size_t tokens = 0;
+    struct lexer *lexer = lexer_new(script, len);
+    struct token token = lexer_peek(lexer);
+    while (token.type != TOKEN_EOF)
+    {
+        token_free(token);
+        lexer_pop(lexer);
+        tokens++;
+        token = lexer_peek(lexer);
+    }
+    lexer_free(lexer);
+    return tokens;
+}
+
+static void parse_all(const char *script, size_t len, size_t *commands,
+                      size_t *counts)
+{
+    struct lexer *lexer = lexer_new(script, len);
+    struct token token = lexer_peek(lexer);
+    while (token.type != TOKEN_EOF)
+    {
+        token_free(token);
+        if (token.type == TOKEN_BACKSLASH)
+            lexer_pop(lexer);
+        else
+        {
+            struct ast *ast = NULL;
+            if (parse(&ast, lexer) != PARSER_OK)
+                break;
+            ast_free(ast);
+            (*commands)++;
+        }
+        token = lexer_peek(lexer);
+    }
+    counts[0] += lexer->lookups;
+    counts[1] += lexer->scans;
+    lexer_free(lexer);
+}
+
+static char *nest(size_t depth, size_t *len)
+{
+    const char *open = "if true; then { ";
+    const char *close = " } fi;";
+    size_t size = depth * (strlen(open) + strlen(close)) + strlen("echo a;");
+    char *script = malloc(size + 1);
+    if (!script)
+        return NULL;
+    size_t pos = 0;
+    for (size_t i = 0; i < depth; i++, pos += strlen(open))
+        memcpy(script + pos, open, strlen(open));
+    memcpy(script + pos, "echo a;", strlen("echo a;"));
+    pos += strlen("echo a;");
+    for (size_t i = 0; i < depth; i++, pos += strlen(close))
+        memcpy(script + pos, close, strlen(close));
+    script[pos] = 0;
+    *len = pos;
+    return script;
+}
+
+static void bench_nesting(int rounds)
+{
+    // An if and a brace group open two levels
+    for (size_t depth = PARSER_MAX_DEPTH / 16; depth <= PARSER_MAX_DEPTH / 2;
+         depth *= 2)
+    {
+        size_t len = 0;
+        char *script = nest(depth, &len);
+        if (!script)
+            return;
+        size_t counts[2] = { 0, 0 };
+        size_t commands = 0;
+        double start = now();
+        for (int i = 0; i < rounds * 100; i++)
+            parse_all(script, len, &commands, counts);
+        double elapsed = now() - start;
+        printf("depth %4zu: %.0f ns/level\n", 2 * depth,
+               elapsed / commands / (2 * depth) * 1e9);
+        free(script);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t nb_lines = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    size_t len = 0;
+    char *script = generate(nb_lines, &len);
+    if (!script)
+        return 1;
+    size_t tokens = count_tokens(script, len) * rounds;
+    size_t counts[2] = { 0, 0 };
+    size_t commands = 0;
+    double start = now();
+    for (int i = 0; i < rounds; i++)
+        parse_all(script, len, &commands, counts);
+    double elapsed = now() - start;
+    printf("%zu commands, %zu tokens in %.3fs: %.0f commands/s\n", commands,
+           tokens, elapsed, commands / elapsed);
+    printf("%.2f lookups/token, %.2f scans/token, %.1f lookups/command\n",
+           (double)counts[0] / tokens, (double)counts[1] / tokens,
+           (double)counts[0] / commands);
+    free(script);
+    bench_nesting(rounds);
+    return 0;
+}
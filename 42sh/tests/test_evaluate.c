@@ -1,14 +1,25 @@
 #include <criterion/criterion.h>
 #include <criterion/redirect.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "ast/cache.h"
 #include "evaluate/evaluate.h"
+#include "evaluate/match.h"
+#include "evaluate/pathname.h"
+#include "evaluate/vm.h"
 #include "parser/parser.h"
 
 TestSuite(Evaluate);
 
 Test(Evaluate, evaluate_simple_command, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("echo a");
+    const char *input = "echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -21,7 +32,8 @@ Test(Evaluate, evaluate_simple_command, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_command_list, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("echo a; echo b; echo c; echo d; echo e");
+    const char *input = "echo a; echo b; echo c; echo d; echo e";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -34,8 +46,9 @@ Test(Evaluate, evaluate_command_list, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_if, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("if false; then echo bite; elif false; "
-                                    "then echo fun; else echo dong; fi");
+    const char *input = "if false; then echo bite; elif false; then echo fun; "
+                        "else echo dong; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -48,8 +61,9 @@ Test(Evaluate, evaluate_if, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_single_quote, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new(
-        "echo 'a b ;d echo if then else ls;;'; echo -n a; echo ';;;;;'");
+    const char *input = "echo 'a b ;d echo if then else ls;;'; echo -n a; "
+                        "echo ';;;;;'";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -62,7 +76,8 @@ Test(Evaluate, evaluate_single_quote, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_EOF, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("");
+    const char *input = "";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -75,8 +90,8 @@ Test(Evaluate, evaluate_EOF, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_comments, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer =
-        lexer_new("echo \\#escaped \"#\"quoted not#first #commented");
+    const char *input = "echo \\#escaped \"#\"quoted not#first #commented";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -88,7 +103,8 @@ Test(Evaluate, evaluate_comments, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_true, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("true");
+    const char *input = "true";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -101,7 +117,8 @@ Test(Evaluate, evaluate_true, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_false, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("false");
+    const char *input = "false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -114,7 +131,8 @@ Test(Evaluate, evaluate_false, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_echo_n, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("echo -n abc; echo -n def");
+    const char *input = "echo -n abc; echo -n def";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -127,8 +145,8 @@ Test(Evaluate, evaluate_echo_n, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_pipe, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer =
-        lexer_new("echo -n Hello, World | tr e a | tr a b | tr b e");
+    const char *input = "echo -n Hello, World | tr e a | tr a b | tr b e";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -141,8 +159,9 @@ Test(Evaluate, evaluate_pipe, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_for1, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new(
-        "for i in 1 2 3 4; do if true; then echo ok; else false; fi;  done");
+    const char *input = "for i in 1 2 3 4; do if true; then echo ok; else "
+                        "false; fi;  done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -155,8 +174,9 @@ Test(Evaluate, evaluate_for1, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_for2, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new(
-        "for i in 1 2 3 4; do for i in 1 2 ;do echo ok; done ; echo tg; done");
+    const char *input = "for i in 1 2 3 4; do for i in 1 2 ;do echo ok; done "
+                        "; echo tg; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -169,8 +189,9 @@ Test(Evaluate, evaluate_for2, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_for3, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("for i in 1 2 3 4; do for i in 1 2 ;do "
-                                    "echo ok; done ; echo tg; done | wc -l");
+    const char *input = "for i in 1 2 3 4; do for i in 1 2 ;do echo ok; done "
+                        "; echo tg; done | wc -l";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -183,8 +204,9 @@ Test(Evaluate, evaluate_for3, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_for4, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("for i in 'ok' 'ok2' 3 'cboneft'; do for i "
-                                    "in 1 2 ;do echo ok; done ; echo tg; done");
+    const char *input = "for i in 'ok' 'ok2' 3 'cboneft'; do for i in 1 2 ;do "
+                        "echo ok; done ; echo tg; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -197,9 +219,9 @@ Test(Evaluate, evaluate_for4, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_for5, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer =
-        lexer_new("for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok | wc -l "
-                  "; done ; echo tg; done | wc -l");
+    const char *input = "for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok "
+                        "| wc -l ; done ; echo tg; done | wc -l";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -212,9 +234,9 @@ Test(Evaluate, evaluate_for5, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_not_existant, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer =
-        lexer_new("for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok | wc -l "
-                  "; done ; echo tg; done | c -l");
+    const char *input = "for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok "
+                        "| wc -l ; done ; echo tg; done | c -l";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -226,8 +248,8 @@ Test(Evaluate, evaluate_not_existant, .init = cr_redirect_stderr)
 
 Test(Evaluate, evaluate_true_false1, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer =
-        lexer_new("true && false || false && true || true && false");
+    const char *input = "true && false || false && true || true && false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -239,7 +261,8 @@ Test(Evaluate, evaluate_true_false1, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_true_false2, .init = cr_redirect_stdout)
 {
-    struct lexer *lexer = lexer_new("true && true || false");
+    const char *input = "true && true || false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -251,9 +274,9 @@ Test(Evaluate, evaluate_true_false2, .init = cr_redirect_stdout)
 
 Test(Evaluate, evaluate_bad_command, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer =
-        lexer_new("for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok | wc -l "
-                  "; done ; echo tg; done | cat t");
+    const char *input = "for i in 1 2 3 4; do for i in 'tg' 'hg' ;do echo ok "
+                        "| wc -l ; done ; echo tg; done | cat t";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     int res = evaluate(ast);
@@ -265,8 +288,9 @@ Test(Evaluate, evaluate_bad_command, .init = cr_redirect_stderr)
 
 Test(Evaluate, evaluate_bad_command2, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer = lexer_new(
-        "a=2; b=txt; echo $a; unset a; echo $b; unset -f b; echo $a $b");
+    const char *input = "a=2; b=txt; echo $a; unset a; echo $b; unset -f b; "
+                        "echo $a $b";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_redirect_stdout();
@@ -278,9 +302,9 @@ Test(Evaluate, evaluate_bad_command2, .init = cr_redirect_stderr)
 
 Test(Evaluate, evaluate_continue, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer =
-        lexer_new("for i in 1 2 3 4 5 ; do if [ $i -eq 3 ]; then continue 3; "
-                  "else echo $i $i;fi ;done ");
+    const char *input = "for i in 1 2 3 4 5 ; do if [ $i -eq 3 ]; then "
+                        "continue 3; else echo $i $i;fi ;done ";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_redirect_stdout();
@@ -292,8 +316,9 @@ Test(Evaluate, evaluate_continue, .init = cr_redirect_stderr)
 
 Test(Evaluate, evaluate_break, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer = lexer_new("for i in 1 2 3 4 5 ; do if [ $i -eq 3 ]; "
-                                    "then break; else echo $i $i;fi ;done ");
+    const char *input = "for i in 1 2 3 4 5 ; do if [ $i -eq 3 ]; then break; "
+                        "else echo $i $i;fi ;done ";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_redirect_stdout();
@@ -302,3 +327,297 @@ Test(Evaluate, evaluate_break, .init = cr_redirect_stderr)
     lexer_free(lexer);
     ast_free(ast);
 }
+
+Test(Evaluate, evaluate_lexer_runs_before_syntax_error,
+     .init = cr_redirect_stdout)
+{
+    const char *input = "echo a; echo b\nif\n";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("a\nb\n");
+    cr_expect_eq(res, 2);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_lexer_keeps_functions, .init = cr_redirect_stdout)
+{
+    const char *input = "f() { echo in f; }\necho x\nf\n";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("x\nin f\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_vm_control_flow, .init = cr_redirect_stdout)
+{
+    const char *input = "for i in a b c; do if false || true; then echo $i; "
+                        "continue; fi; echo no; done\n"
+                        "while true; do echo w; break; done; ! true\n"
+                        "echo $?\n";
+    setenv(VM_ENV, "1", 1);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    unsetenv(VM_ENV);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("a\nb\nc\nw\n1\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_vm_resolves_builtins)
+{
+    const char *input = "echo a; $x b";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    struct program *program = vm_compile(ast);
+    int runs = 0;
+    for (int i = 0; i < program->size; i++)
+    {
+        if (program->code[i].op != OP_RUN)
+            continue;
+        enum builtin expected = runs++ ? BUILTIN_UNKNOWN : BUILTIN_ECHO;
+        cr_expect_eq(program->code[i].builtin, expected);
+    }
+    cr_expect_eq(runs, 2);
+    cr_expect_eq(program->code[program->size - 1].op, OP_HALT);
+    vm_free(program);
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Evaluate, table_grows_and_removes)
+{
+    struct table table = { NULL, 0, 0, 0 };
+    struct table_entry entries[100];
+    char keys[100][8];
+    for (int i = 0; i < 100; i++)
+    {
+        sprintf(keys[i], "k%d", i);
+        entries[i].key = keys[i];
+        table_insert(&table, &entries[i]);
+    }
+    cr_expect_eq(table.size, 100);
+    cr_expect_eq(table_find(&table, "k42"), &entries[42]);
+    cr_expect_eq(table_remove(&table, "k42"), &entries[42]);
+    cr_expect_eq(table_find(&table, "k42"), NULL);
+    cr_expect_eq(table_find(&table, "k99"), &entries[99]);
+    size_t pos = 0;
+    int nb = 0;
+    while (table_next(&table, &pos))
+        nb++;
+    cr_expect_eq(nb, 99);
+    table_free(&table);
+}
+
+Test(Evaluate, evaluate_many_variables, .init = cr_redirect_stdout)
+{
+    char input[16384] = "";
+    for (int i = 0; i < 500; i++)
+        sprintf(input + strlen(input), "v%d=%d; ", i, i);
+    strcat(input, "unset v7; echo $v0 $v250 $v499");
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("0 250 499\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_special_parameters, .init = cr_redirect_stdout)
+{
+    char input[] = "f() { echo $# $1 $2 $@; }; f a b c; g() { echo $#; }; g; "
+                   "false; echo $?; echo $3";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("3 a b a b c\n0\n1\n\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_functions_outlive_sourced_file,
+     .init = cr_redirect_stdout)
+{
+    char path[] = "/tmp/42sh_libXXXXXX";
+    int fd = mkstemp(path);
+    cr_assert_neq(fd, -1);
+    const char *lib = "lib() { echo lib $1; }\nf() { f() { echo new; }; "
+                      "echo old; }\n";
+    cr_assert_eq(write(fd, lib, strlen(lib)), (ssize_t)strlen(lib));
+    close(fd);
+    char input[128];
+    sprintf(input, ". %s; lib a; f; f", path);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("lib a\nold\nnew\n");
+    lexer_free(lexer);
+    unlink(path);
+}
+
+Test(Evaluate, evaluate_call_frames, .init = cr_redirect_stdout)
+{
+    char input[] = "g() { echo g $1 $#; }; "
+                   "f() { shift; echo $1 $#; g x; echo $1 $@; }; f a b c; "
+                   "r() { if test $1 = a; then r b; fi; echo $1; }; r a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("b 2\ng x 1\nb b c\nb\na\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_word_expansion, .init = cr_redirect_stdout)
+{
+    char input[] = "x=b; y='1  2'; echo a${x}c \"$x-$x\" '$x' \\$x; "
+                   "f() { echo $#; }; f $y; f \"$y\"; f $none; f \"\"; "
+                   "g() { f \"$@\"; }; g 'p q' r; "
+                   "for i in $y; do echo $i; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("abc b-b $x $x\n2\n1\n0\n1\n2\n1\n2\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_parameter_operators, .init = cr_redirect_stdout)
+{
+    char input[] = "f=/usr/lib/a.tar.gz; echo ${#f} ${f##*/} ${f%/*} "
+                   "${f#*.} ${f%%.*}; echo ${u:-d} ${f:+s} \"${e=}\"x; "
+                   "echo ${n:=v} $n \"${f#\"/usr\"}\" ${f%'.gz'}";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("17 a.tar.gz /usr/lib tar.gz /usr/lib/a\n"
+                            "d s x\nv v /lib/a.tar.gz /usr/lib/a.tar\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_arithmetic, .init = cr_redirect_stdout)
+{
+    char input[] = "i=0; while [ $i -lt 3 ]; do i=$(( i + 1 )); done; "
+                   "echo $i $((1 + 2 * 3)) $(((1 + 2) * 3)) $((-7 % 3)) "
+                   "\"$((0x10 | 010))\" $((i > 2 ? i << 2 : 0)); "
+                   "echo $((x = 4, x *= i)) $x $((0 && (y = 1))) ${y-u}";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("3 7 9 -1 24 12\n12 12 0 u\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_command_substitution, .init = cr_redirect_stdout)
+{
+    char input[] = "f() { echo \"<$1>\"; x=in; }; x=out; "
+                   "echo $(f a) \"$(echo '1  2'; echo)\" `echo b` $x; "
+                   "y=$(false); echo $? $(echo c | tr c d) $(exit 3)$?; "
+                   "z=$( if true; then echo e; fi ); "
+                   "echo $z $( (echo g) ) $( { echo h; } ) ` echo i`";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("<a> 1  2 b out\n1 d 3\ne g h i\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+}
+
+Test(Evaluate, evaluate_pathname_expansion, .init = cr_redirect_stdout)
+{
+    char dir[] = "/tmp/42sh_glob_XXXXXX";
+    cr_assert_neq(mkdtemp(dir), NULL);
+    char input[512];
+    sprintf(input,
+            "cd %s; echo a > b.c; echo a > a.c; echo a > .h.c; echo a > c.h; "
+            "echo *.c \"*.c\" \\*.c z* [ab].h; for f in ?.h; do echo $f; "
+            "done; x='*.h'; echo $x \"$x\"; rm a.c b.c .h.c c.h",
+            dir);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    int res = evaluate_lexer(lexer);
+    fflush(stdout);
+    cr_expect_stdout_eq_str("a.c b.c *.c *.c z* [ab].h\nc.h\nc.h *.h\n");
+    cr_expect_eq(res, 0);
+    lexer_free(lexer);
+    rmdir(dir);
+}
+
+// Runs the script at path in a child with the cache in dir, returns its status
+static int run_cached_script(const char *path, const char *dir)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        setenv(CACHE_DIR_ENV, dir, 1);
+        struct lexer *lexer = lexer_new_file(path);
+        exit(lexer ? evaluate_lexer(lexer) : 127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+Test(Evaluate, cache_script_ending_with_exit, .init = cr_redirect_stdout)
+{
+    char dir[] = "/tmp/42sh_cache_XXXXXX";
+    cr_assert_neq(mkdtemp(dir), NULL);
+    char path[64];
+    sprintf(path, "%s.sh", dir);
+    FILE *script = fopen(path, "w");
+    cr_assert_neq(script, NULL);
+    fputs("echo one\nexit 3\necho two\n", script);
+    fclose(script);
+    cr_expect_eq(run_cached_script(path, dir), 3);
+    cr_expect_eq(run_cached_script(path, dir), 3);
+    cr_expect_stdout_eq_str("one\none\n");
+    DIR *d = opendir(dir);
+    cr_assert_neq(d, NULL);
+    int entries = 0;
+    int hidden = 0;
+    char file[128];
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+    {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        hidden += entry->d_name[0] == '.';
+        entries += entry->d_name[0] != '.';
+        sprintf(file, "%s/%s", dir, entry->d_name);
+        unlink(file);
+    }
+    closedir(d);
+    cr_expect_eq(entries, 1);
+    cr_expect_eq(hidden, 0);
+    unlink(path);
+    rmdir(dir);
+}
+
+Test(Evaluate, pathname_patterns)
+{
+    cr_expect(is_pattern("*.c", 3));
+    cr_expect(is_pattern("a/[bc]", 6));
+    cr_expect(!is_pattern("[", 1));
+    cr_expect(!is_pattern("\\*.c", 4));
+    cr_expect(!is_pattern("plain", 5));
+}
+
+Test(Evaluate, match_patterns)
+{
+    cr_expect(match("*.c", "main.c", 6));
+    cr_expect(!match("*.c", "main.h", 6));
+    cr_expect(match("a?c", "abc", 3));
+    cr_expect(match("[a-c]*[!x]", "bxy", 3));
+    cr_expect(!match("[a-c]*[!x]", "byx", 3));
+    cr_expect(match("\\*", "*", 1));
+    cr_expect(!match("\\*", "a", 1));
+    cr_expect(match("[", "[", 1));
+    cr_expect(match("*a*b", "xaxxb", 5));
+    cr_expect(match("ab", "abc", 2));
+}
@@ -1,67 +1,84 @@
 #include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "lexer/lexer.h"
+#include "lexer/scan.h"
 #include "lexer/token.h"
 
 TestSuite(Lexer);
 
+static void expect_text(struct lexer *lexer, struct token token,
+                        const char *text)
+{
+    cr_expect_eq(token.len, strlen(text));
+    cr_expect_eq(strncmp(token_text(lexer, token), text, token.len), 0);
+}
+
 Test(Lexer, test_new)
 {
-    struct lexer *lexer = lexer_new("help");
+    const char *input = "help";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     cr_expect_str_eq(lexer->input, "help");
+    cr_expect_eq(lexer->len, 4);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_simple_command)
 {
-    struct lexer *lexer = lexer_new("echo a");
+    const char *input = "echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "echo");
+    expect_text(lexer, token, "echo");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "a");
+    expect_text(lexer, token, "a");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_command_list)
 {
-    struct lexer *lexer = lexer_new("echo a; echo b; echo c; ls /bin;");
+    const char *input = "echo a; echo b; echo c; ls /bin;";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "echo");
+    expect_text(lexer, token, "echo");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_SEMI_COLON);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     for (int i = 0; i < 8; i++)
         lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "/bin");
+    expect_text(lexer, token, "/bin");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_if)
 {
-    struct lexer *lexer = lexer_new("if true; then echo a; else echo b; fi");
+    const char *input = "if true; then echo a; else echo b; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_IF);
-    cr_expect_str_eq(token.data, "if");
+    expect_text(lexer, token, "if");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_THEN);
-    cr_expect_str_eq(token.data, "then");
+    expect_text(lexer, token, "then");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
@@ -69,7 +86,7 @@ Test(Lexer, lexer_if)
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_ELSE);
-    cr_expect_str_eq(token.data, "else");
+    expect_text(lexer, token, "else");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
@@ -77,88 +94,91 @@ Test(Lexer, lexer_if)
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_FI);
-    cr_expect_str_eq(token.data, "fi");
+    expect_text(lexer, token, "fi");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_elif)
 {
-    struct lexer *lexer = lexer_new(
-        "if true; then echo a; elif echo b; then echo c; else echo d; fi");
+    const char *input = "if true; then echo a; elif echo b; then echo c; else "
+                        "echo d; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     for (int i = 0; i < 7; i++)
         lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_ELIF);
-    cr_expect_str_eq(token.data, "elif");
+    expect_text(lexer, token, "elif");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_backslash)
 {
-    struct lexer *lexer =
-        lexer_new("if false\ntrue\nthen\necho a\echo b; echo c\nfi");
+    const char *input = "if false\ntrue\nthen\necho a\echo b; echo c\nfi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_BACKSLASH);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_single_quotes)
 {
-    struct lexer *lexer = lexer_new("echo 'a b ;if d' b");
+    const char *input = "echo 'a b ;if d' b";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "a b ;if d");
+    expect_text(lexer, token, "'a b ;if d'");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "b");
+    expect_text(lexer, token, "b");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_comments)
 {
-    struct lexer *lexer =
-        lexer_new("echo \\#escaped \"#\"quoted not#first #commented");
+    const char *input = "echo \\#escaped \"#\"quoted not#first #commented";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "#escaped");
+    expect_text(lexer, token, "\\#escaped");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "#quoted");
+    expect_text(lexer, token, "\"#\"quoted");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "not#first");
+    expect_text(lexer, token, "not#first");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_while)
 {
-    struct lexer *lexer = lexer_new("while true; do echo a; done");
+    const char *input = "while true; do echo a; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WHILE);
-    cr_expect_str_eq(token.data, "while");
+    expect_text(lexer, token, "while");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_DO);
-    cr_expect_str_eq(token.data, "do");
+    expect_text(lexer, token, "do");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
@@ -166,168 +186,182 @@ Test(Lexer, lexer_while)
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_DONE);
-    cr_expect_str_eq(token.data, "done");
+    expect_text(lexer, token, "done");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_until)
 {
-    struct lexer *lexer = lexer_new("until true; do echo a; done");
+    const char *input = "until true; do echo a; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_UNTIL);
-    cr_expect_str_eq(token.data, "until");
+    expect_text(lexer, token, "until");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_neg)
 {
-    struct lexer *lexer = lexer_new("! true; ! false");
+    const char *input = "! true; ! false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_NEG);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_NEG);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_and)
 {
-    struct lexer *lexer = lexer_new("true && false");
+    const char *input = "true && false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_AND);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_or)
 {
-    struct lexer *lexer = lexer_new("true || false");
+    const char *input = "true || false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_OR);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_01)
 {
-    struct lexer *lexer = lexer_new("> test.txt echo a");
+    const char *input = "> test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, ">");
+    expect_text(lexer, token, ">");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_02)
 {
-    struct lexer *lexer = lexer_new("< test.txt echo a");
+    const char *input = "< test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, "<");
+    expect_text(lexer, token, "<");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_03)
 {
-    struct lexer *lexer = lexer_new(">> test.txt echo a");
+    const char *input = ">> test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, ">>");
+    expect_text(lexer, token, ">>");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_04)
 {
-    struct lexer *lexer = lexer_new(">& test.txt echo a");
+    const char *input = ">& test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, ">&");
+    expect_text(lexer, token, ">&");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_05)
 {
-    struct lexer *lexer = lexer_new("<& test.txt echo a");
+    const char *input = "<& test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, "<&");
+    expect_text(lexer, token, "<&");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_06)
 {
-    struct lexer *lexer = lexer_new(">| test.txt echo a");
+    const char *input = ">| test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, ">|");
+    expect_text(lexer, token, ">|");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_redir_07)
 {
-    struct lexer *lexer = lexer_new("<> test.txt echo a");
+    const char *input = "<> test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_REDIR);
-    cr_expect_str_eq(token.data, "<>");
+    expect_text(lexer, token, "<>");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_pipe)
 {
-    struct lexer *lexer = lexer_new("ls | echo");
+    const char *input = "ls | echo";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     lexer_pop(lexer);
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_PIPE);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_command_block)
 {
-    struct lexer *lexer = lexer_new("{ echo a } | tr a h");
+    const char *input = "{ echo a } | tr a h";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_LEFT_BRACKET);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_RIGHT_BRACKET);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_subshell)
 {
-    struct lexer *lexer = lexer_new("(a=42; echo $a); echo a");
+    const char *input = "(a=42; echo $a); echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_LEFT_PARENTHESIS);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_ASSIGNMENT_WORD);
-    cr_expect_str_eq(token.data, "a=42");
+    expect_text(lexer, token, "a=42");
     token_free(token);
     lexer_pop(lexer);
     lexer_pop(lexer);
@@ -335,47 +369,235 @@ Test(Lexer, lexer_subshell)
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_RIGHT_PARENTHESIS);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_func)
 {
-    struct lexer *lexer = lexer_new("func(){ echo a; }; func 0;");
+    const char *input = "func(){ echo a; }; func 0;";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "func");
+    expect_text(lexer, token, "func");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_LEFT_PARENTHESIS);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_RIGHT_PARENTHESIS);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_LEFT_BRACKET);
-    cr_expect_str_eq(token.data, "");
+    expect_text(lexer, token, "");
     token_free(token);
     lexer_free(lexer);
 }
 
 Test(Lexer, lexer_variable)
 {
-    struct lexer *lexer = lexer_new("echo $a");
+    const char *input = "echo $a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct token token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "echo");
+    expect_text(lexer, token, "echo");
     token_free(token);
     lexer_pop(lexer);
     token = lexer_peek(lexer);
     cr_expect_eq(token.type, TOKEN_WORD);
-    cr_expect_str_eq(token.data, "$a");
+    expect_text(lexer, token, "$a");
+    token_free(token);
+    lexer_free(lexer);
+}
+
+Test(Lexer, lexer_slices)
+{
+    const char *input = "echo 'a b' c\\ d";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct token token = lexer_peek(lexer);
+    cr_expect_eq(token.data, NULL);
+    cr_expect_eq(token.offset, 0);
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.data, NULL);
+    cr_expect_eq(token.offset, 5);
+    expect_text(lexer, token, "'a b'");
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.data, NULL);
+    expect_text(lexer, token, "c\\ d");
     token_free(token);
     lexer_free(lexer);
 }
+
+Test(Lexer, lexer_lookahead)
+{
+    const char *input = "echo a\\ b; ls";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct token token = lexer_peek(lexer);
+    lexer_pop(lexer);
+    cr_expect_eq(lexer->pos, 5);
+    token = lexer_peek(lexer);
+    lexer_pop(lexer);
+    cr_expect_eq(lexer->ahead[0].valid, 1);
+    cr_expect_eq(lexer->ahead[1].valid, 1);
+    token_free(token);
+    lexer->pos = 5;
+    token = lexer_peek(lexer);
+    expect_text(lexer, token, "a\\ b");
+    cr_expect_eq(token.data, NULL);
+    token_free(token);
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_SEMI_COLON);
+    lexer_free(lexer);
+}
+
+Test(Lexer, lexer_unterminated_input)
+{
+    const char input[] = { 'e', 'c', 'h', 'o', ' ', 'a', '\0', 'b', '|' };
+    struct lexer *lexer = lexer_new(input, sizeof(input) - 1);
+    lexer_pop(lexer);
+    struct token token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_WORD);
+    cr_expect_eq(token.len, 3);
+    cr_expect_eq(memcmp(token_text(lexer, token), "a\0b", 3), 0);
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_EOF);
+    lexer_free(lexer);
+}
+
+Test(Lexer, lexer_keywords)
+{
+    const char *input = "if iff in fi do dont done for fore then elif else "
+                        "elsa while until untie";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    enum token_type types[] = {
+        TOKEN_IF,   TOKEN_WORD,  TOKEN_IN,    TOKEN_FI,    TOKEN_DO,
+        TOKEN_WORD, TOKEN_DONE,  TOKEN_FOR,   TOKEN_WORD,  TOKEN_THEN,
+        TOKEN_ELIF, TOKEN_ELSE,  TOKEN_WORD,  TOKEN_WHILE, TOKEN_UNTIL,
+        TOKEN_WORD, TOKEN_EOF,
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(*types); i++)
+    {
+        struct token token = lexer_peek(lexer);
+        cr_expect_eq(token.type, types[i]);
+        lexer_pop(lexer);
+    }
+    lexer_free(lexer);
+}
+
+Test(Lexer, scan_levels)
+{
+    struct scan_set set;
+    scan_set_init(&set, " \n;{}\\");
+    char buffer[100];
+    for (int level = SCAN_SCALAR; level <= SCAN_AVX2; level++)
+    {
+        scan_select(level);
+        for (size_t stop = 0; stop <= sizeof(buffer); stop++)
+        {
+            memset(buffer, 'a', sizeof(buffer));
+            buffer[0] = '\xe9';
+            if (stop < sizeof(buffer))
+                buffer[stop] = stop % 2 ? '\\' : '\n';
+            cr_expect_eq(scan_until(buffer, sizeof(buffer), &set), stop);
+            memset(buffer, ' ', sizeof(buffer));
+            if (stop < sizeof(buffer))
+                buffer[stop] = 0;
+            cr_expect_eq(scan_while(buffer, sizeof(buffer), ' '), stop);
+        }
+    }
+}
+
+Test(Lexer, lexer_long_quotes)
+{
+    char input[300] = "echo '";
+    memset(input + 6, 'x', 200);
+    strcpy(input + 206, "' # comment                                  ;\n");
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    lexer_pop(lexer);
+    struct token token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_WORD);
+    cr_expect_eq(token.offset, 5);
+    cr_expect_eq(token.len, 202);
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_BACKSLASH);
+    lexer_pop(lexer);
+    token = lexer_peek(lexer);
+    cr_expect_eq(token.type, TOKEN_BACKSLASH);
+    cr_expect_eq(lexer->pos, strlen(input) - 1);
+    lexer_free(lexer);
+}
+
+Test(Lexer, lexer_stream)
+{
+    int fds[2];
+    cr_expect_eq(pipe(fds), 0);
+    char word[32];
+    for (int i = 0; i < 4000; i++)
+    {
+        int len = sprintf(word, "w%d ", i);
+        cr_expect_eq(write(fds[1], word, len), len);
+    }
+    close(fds[1]);
+    struct lexer *lexer = lexer_new_fd(fds[0]);
+    for (int i = 0; i < 4000; i++)
+    {
+        struct token token = lexer_peek(lexer);
+        sprintf(word, "w%d", i);
+        cr_expect_eq(token.type, TOKEN_WORD);
+        expect_text(lexer, token, word);
+        lexer_pop(lexer);
+        lexer_discard(lexer);
+    }
+    cr_expect_eq(lexer_peek(lexer).type, TOKEN_EOF);
+    cr_expect_eq(lexer->capacity, LEXER_CHUNK);
+    cr_expect_neq(lexer->base, 0);
+    lexer_free(lexer);
+    close(fds[0]);
+}
+
+Test(Lexer, lexer_file)
+{
+    char path[] = "/tmp/42sh_lexer_XXXXXX";
+    int fd = mkstemp(path);
+    cr_expect_neq(fd, -1);
+    cr_expect_eq(write(fd, "echo mapped", 11), 11);
+    close(fd);
+    struct lexer *lexer = lexer_new_file(path);
+    cr_expect_eq(lexer->mapped, 1);
+    lexer_pop(lexer);
+    struct token token = lexer_peek(lexer);
+    expect_text(lexer, token, "mapped");
+    lexer_free(lexer);
+    unlink(path);
+    lexer = lexer_new_file("/dev/null");
+    cr_expect_eq(lexer->mapped, 0);
+    cr_expect_eq(lexer_peek(lexer).type, TOKEN_EOF);
+    lexer_free(lexer);
+    cr_expect_eq(lexer_new_file("/nonexistent/script.sh"), NULL);
+}
+
+Test(Lexer, lexer_substitutions)
+{
+    char input[] = "echo a$(echo (b); c)d `echo e\\` f` $((1 + (2)))";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    lexer_pop(lexer);
+    expect_text(lexer, lexer_peek(lexer), "a$(echo (b); c)d");
+    lexer_pop(lexer);
+    expect_text(lexer, lexer_peek(lexer), "`echo e\\` f`");
+    lexer_pop(lexer);
+    expect_text(lexer, lexer_peek(lexer), "$((1 + (2)))");
+    lexer_pop(lexer);
+    cr_expect_eq(lexer_peek(lexer).type, TOKEN_EOF);
+    lexer_free(lexer);
+}
@@ -1,13 +1,17 @@
 #include <criterion/criterion.h>
 #include <criterion/redirect.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "ast/cache.h"
 #include "parser/parser.h"
 
 TestSuite(Parser);
 
 Test(Parser, parse_simple_command)
 {
-    struct lexer *lexer = lexer_new("echo a");
+    const char *input = "echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -17,8 +21,9 @@ Test(Parser, parse_simple_command)
 
 Test(Parser, parse_command_list)
 {
-    struct lexer *lexer =
-        lexer_new("echo a; echo b; echo c; ls /bin; cat Makefile; find t*;");
+    const char *input = "echo a; echo b; echo c; ls /bin; cat Makefile; find "
+                        "t*;";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -28,8 +33,9 @@ Test(Parser, parse_command_list)
 
 Test(Parser, parse_if)
 {
-    struct lexer *lexer = lexer_new("if false; then echo bite; elif false; "
-                                    "then echo fun; else echo dong; fi");
+    const char *input = "if false; then echo bite; elif false; then echo fun; "
+                        "else echo dong; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -39,8 +45,8 @@ Test(Parser, parse_if)
 
 Test(Parser, parse_single_quotes)
 {
-    struct lexer *lexer =
-        lexer_new("echo 'a b ;d echo if then else ls;;'; a; ';;;;;'");
+    const char *input = "echo 'a b ;d echo if then else ls;;'; a; ';;;;;'";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -50,7 +56,8 @@ Test(Parser, parse_single_quotes)
 
 Test(Parser, parse_EOF)
 {
-    struct lexer *lexer = lexer_new("");
+    const char *input = "";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -60,8 +67,8 @@ Test(Parser, parse_EOF)
 
 Test(Parser, parse_comments)
 {
-    struct lexer *lexer =
-        lexer_new("echo \\#escaped \"#\"quoted not#first #commented");
+    const char *input = "echo \\#escaped \"#\"quoted not#first #commented";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -71,7 +78,8 @@ Test(Parser, parse_comments)
 
 Test(Parser, parse_while)
 {
-    struct lexer *lexer = lexer_new("while true; do echo a; done");
+    const char *input = "while true; do echo a; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -81,7 +89,8 @@ Test(Parser, parse_while)
 
 Test(Parser, parse_until)
 {
-    struct lexer *lexer = lexer_new("until true; do echo a; done");
+    const char *input = "until true; do echo a; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -91,7 +100,8 @@ Test(Parser, parse_until)
 
 Test(Parser, parse_pipe)
 {
-    struct lexer *lexer = lexer_new("echo a | echo b");
+    const char *input = "echo a | echo b";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -101,7 +111,8 @@ Test(Parser, parse_pipe)
 
 Test(Parser, parse_neg)
 {
-    struct lexer *lexer = lexer_new("if ! true; then echo a; else echo b; fi");
+    const char *input = "if ! true; then echo a; else echo b; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -111,7 +122,8 @@ Test(Parser, parse_neg)
 
 Test(Parser, parse_and)
 {
-    struct lexer *lexer = lexer_new("true && false");
+    const char *input = "true && false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -121,7 +133,8 @@ Test(Parser, parse_and)
 
 Test(Parser, parse_or)
 {
-    struct lexer *lexer = lexer_new("true || false");
+    const char *input = "true || false";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -131,8 +144,8 @@ Test(Parser, parse_or)
 
 Test(Parser, parse_and_or)
 {
-    struct lexer *lexer =
-        lexer_new("true || false && false && true || false || true");
+    const char *input = "true || false && false && true || false || true";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -142,7 +155,8 @@ Test(Parser, parse_and_or)
 
 Test(Parser, parse_redir)
 {
-    struct lexer *lexer = lexer_new("> test.txt echo a");
+    const char *input = "> test.txt echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -152,7 +166,8 @@ Test(Parser, parse_redir)
 
 Test(Parser, parse_for)
 {
-    struct lexer *lexer = lexer_new("for i in 1 2 3 4 5; do echo a; done");
+    const char *input = "for i in 1 2 3 4 5; do echo a; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     cr_expect_eq(status, PARSER_OK);
@@ -162,7 +177,8 @@ Test(Parser, parse_for)
 
 Test(Parser, parse_wrong_grammar_01, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer = lexer_new("echo ;;");
+    const char *input = "echo ;;";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     fflush(stderr);
@@ -174,7 +190,8 @@ Test(Parser, parse_wrong_grammar_01, .init = cr_redirect_stderr)
 
 Test(Parser, parse_wrong_grammar_02, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer = lexer_new("if true; then; fi");
+    const char *input = "if true; then; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     fflush(stderr);
@@ -186,8 +203,9 @@ Test(Parser, parse_wrong_grammar_02, .init = cr_redirect_stderr)
 
 Test(Parser, parse_wrong_grammar_03, .init = cr_redirect_stderr)
 {
-    struct lexer *lexer =
-        lexer_new("if false; then echo a; elif false; echo b; else echo c; fi");
+    const char *input = "if false; then echo a; elif false; echo b; else echo "
+                        "c; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
     struct ast *ast = NULL;
     enum parser_status status = parse(&ast, lexer);
     fflush(stderr);
@@ -196,3 +214,247 @@ Test(Parser, parse_wrong_grammar_03, .init = cr_redirect_stderr)
     lexer_free(lexer);
     ast_free(ast);
 }
+
+Test(Parser, parse_words_in_arena)
+{
+    const char *input = "echo a 'b c' d e f g h i";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    cr_expect_eq(status, PARSER_OK);
+    cr_expect_neq(ast->arena, NULL);
+    struct ast *cmd = ast->ast_list[0];
+    cr_expect_eq(cmd->nb_data, 9);
+    cr_expect_str_eq(cmd->data[2], "'b c'");
+    cr_expect_str_eq(cmd->data[8], "i");
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, arena_realloc_in_place)
+{
+    struct arena *arena = arena_new();
+    char *first = arena_alloc(arena, 8);
+    char *grown = arena_realloc(arena, first, 8, 64);
+    cr_expect_eq(first, grown);
+    char *other = arena_alloc(arena, 8);
+    char *moved = arena_realloc(arena, grown, 64, 128);
+    cr_expect_neq(moved, grown);
+    cr_expect_neq(moved, other);
+    arena_free(arena);
+}
+
+Test(Parser, flatten_keeps_children_contiguous)
+{
+    const char *input = "if true; then echo a b; fi; echo c";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    cr_expect_eq(status, PARSER_OK);
+    ast = ast_flatten(ast);
+    cr_expect_eq(ast->nb_ast, 2);
+    cr_expect_eq(ast->ast_list[0], ast + 1);
+    cr_expect_eq(ast->ast_list[1], ast + 2);
+    struct ast *if_ast = ast->ast_list[0];
+    cr_expect_eq(if_ast->type, AST_IF);
+    cr_expect_eq(if_ast->ast_list[1], if_ast->ast_list[0] + 1);
+    struct ast *echo = if_ast->ast_list[1]->ast_list[0];
+    cr_expect_eq(echo->nb_data, 3);
+    cr_expect_str_eq(echo->data[2], "b");
+    cr_expect_str_eq(ast->ast_list[1]->data[1], "c");
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, parse_scans_each_token_once)
+{
+    const char *input = "f() { echo a; }; if true; then f b > c; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    cr_expect_eq(status, PARSER_OK);
+    // 19 tokens and the end of input
+    cr_expect_eq(lexer->scans, 20);
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+static char *nest_blocks(int depth)
+{
+    char *input = calloc(4 * depth + 8, sizeof(char));
+    for (int i = 0; i < depth; i++)
+        strcat(input, "{ ");
+    strcat(input, "true;");
+    for (int i = 0; i < depth; i++)
+        strcat(input, " }");
+    return input;
+}
+
+Test(Parser, parse_max_depth)
+{
+    char *input = nest_blocks(PARSER_MAX_DEPTH);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    cr_expect_eq(status, PARSER_OK);
+    lexer_free(lexer);
+    ast_free(ast);
+    free(input);
+}
+
+Test(Parser, parse_too_deep, .init = cr_redirect_stderr)
+{
+    char *input = nest_blocks(PARSER_MAX_DEPTH + 1);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    fflush(stderr);
+    cr_expect_stderr_eq_str("Nested deeper than 5000 levels\n");
+    cr_expect_eq(status, PARSER_TOO_DEEP);
+    cr_expect_eq(ast, NULL);
+    lexer_free(lexer);
+    free(input);
+}
+
+static char *chain_redirections(int nb)
+{
+    char *input = calloc(4 * nb + 8, sizeof(char));
+    strcat(input, "echo a");
+    for (int i = 0; i < nb; i++)
+        strcat(input, " >b");
+    return input;
+}
+
+Test(Parser, parse_redirection_chain)
+{
+    char *input = chain_redirections(PARSER_MAX_DEPTH);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    cr_expect_eq(status, PARSER_OK);
+    lexer_free(lexer);
+    ast_free(ast);
+    free(input);
+}
+
+Test(Parser, parse_redirection_chain_too_deep, .init = cr_redirect_stderr)
+{
+    char *input = chain_redirections(PARSER_MAX_DEPTH + 1);
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    enum parser_status status = parse(&ast, lexer);
+    fflush(stderr);
+    cr_expect_stderr_eq_str("Nested deeper than 5000 levels\n");
+    cr_expect_eq(status, PARSER_TOO_DEEP);
+    cr_expect_eq(ast, NULL);
+    lexer_free(lexer);
+    free(input);
+}
+
+static int same_tree(struct ast *a, struct ast *b)
+{
+    if (a->type != b->type || a->nb_data != b->nb_data
+        || a->nb_ast != b->nb_ast)
+        return 0;
+    for (int i = 0; i < a->nb_data; i++)
+        if (strcmp(a->data[i], b->data[i]))
+            return 0;
+    for (int i = 0; i < a->nb_ast; i++)
+        if (!same_tree(a->ast_list[i], b->ast_list[i]))
+            return 0;
+    return 1;
+}
+
+Test(Parser, cache_round_trip)
+{
+    char dir[] = "/tmp/42sh_cacheXXXXXX";
+    cr_assert_neq(mkdtemp(dir), NULL);
+    setenv(CACHE_DIR_ENV, dir, 1);
+    const char *input = "for i in a b; do echo $i; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    ast = ast_flatten(ast);
+    struct cache *cache = cache_new(input, strlen(input));
+    cache_add(cache, ast);
+    cache_commit(cache);
+    cache_free(cache);
+
+    cache = cache_new(input, strlen(input));
+    size_t nb = 0;
+    struct ast **cached = cache_load(cache, &nb);
+    cr_assert_neq(cached, NULL);
+    cr_expect_eq(nb, 1);
+    cr_expect(same_tree(cached[0], ast));
+    cr_expect_neq(cached[0]->arena, NULL);
+    unlink(cache->path);
+    rmdir(dir);
+    unsetenv(CACHE_DIR_ENV);
+    cache_free(cache);
+    ast_free(cached[0]);
+    free(cached);
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, optimize_drops_single_lists)
+{
+    const char *input = "echo a";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    cr_expect_eq(ast->type, AST_LIST);
+    ast = ast_optimize(ast, 0);
+    cr_expect_eq(ast->type, AST_COMMAND);
+    cr_expect_neq(ast->arena, NULL);
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, optimize_folds_known_if)
+{
+    const char *input = "if true; then echo a; else echo b; fi";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    ast = ast_optimize(ast, 0);
+    cr_assert_eq(ast->type, AST_LIST);
+    cr_assert_eq(ast->nb_ast, 2);
+    cr_expect_str_eq(ast->ast_list[0]->data[0], "true");
+    cr_expect_str_eq(ast->ast_list[1]->data[1], "a");
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, optimize_keeps_status_of_negation)
+{
+    const char *input = "while ! false; do { ! true; }; done";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    ast = ast_optimize(ast, 0);
+    cr_assert_eq(ast->type, AST_WHILE);
+    cr_expect_eq(ast->ast_list[0]->type, AST_LIST);
+    cr_expect_eq(ast->ast_list[0]->ast_list[0]->type, AST_NEG);
+    lexer_free(lexer);
+    ast_free(ast);
+}
+
+Test(Parser, parse_tags_expandable_words)
+{
+    const char *input = "echo a b c; echo $x d";
+    struct lexer *lexer = lexer_new(input, strlen(input));
+    struct ast *ast = NULL;
+    cr_assert_eq(parse(&ast, lexer), PARSER_OK);
+    struct ast *literal = ast->ast_list[0];
+    cr_expect_eq(literal->expand, 0);
+    cr_expect_eq(literal->data[literal->nb_data], NULL);
+    cr_expect_eq(ast->ast_list[1]->expand, 1);
+    ast = ast_flatten(ast);
+    literal = ast->ast_list[0];
+    cr_expect_eq(literal->expand, 0);
+    cr_expect_str_eq(literal->data[3], "c");
+    cr_expect_eq(literal->data[4], NULL);
+    lexer_free(lexer);
+    ast_free(ast);
+}